@@ -0,0 +1,476 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "biginteger.hpp"
+
+// Benchmarks BigInteger and Rational operations over operand sizes and
+// writes one row per operation, input kind and size as CSV or JSON. See
+// kUsage for the options.
+
+const char kUsage[] =
+    " [--json] [--output PATH] [--filter NAME] [--max-digits N]\n"
+    "    [--step FACTOR] [--min-time SECONDS] [--karatsuba LIMBS]\n"
+    "    [--toom LIMBS] [--ntt LIMBS] [--division LIMBS] [--threads N]\n"
+    "    [--parallel-threshold LIMBS]\n"
+    "Sizes run from 1 digit up to --max-digits (default 1000000), growing by\n"
+    "--step (default 2). gcd and as_decimal stop at 100000 digits,\n"
+    "rational_add and rational_mul at 10000. The threshold options override\n"
+    "BigInteger's multiplication, division and thread settings; the ones not\n"
+    "given keep BigInteger's own values.\n";
+
+// Forwards to the global heap and counts allocations. An untimed pass
+// installs it with MemoryResourceScope, so it sees every limb array
+// allocated by the operation under test.
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  size_t allocations() const { return allocations_; }
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    ++allocations_;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* pointer, size_t bytes, size_t alignment) override {
+    std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+  }
+
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  size_t allocations_ = 0;
+};
+
+struct Case {
+  std::function<void()> run;
+  size_t limbs;
+};
+
+struct Benchmark {
+  std::string name;
+  size_t max_digits;
+  std::function<Case(size_t digits, bool is_adversarial, std::mt19937& random)>
+      prepare;
+};
+
+struct Measurement {
+  std::string operation;
+  std::string input;
+  size_t digits;
+  size_t iterations;
+  double nanoseconds_per_operation;
+  double allocations_per_operation;
+  double limbs_per_second;
+};
+
+const double kBitsPerDigit = 3.3219280948873623;
+const size_t kLimbBits = 32;
+
+std::string RandomDigits(size_t digits, std::mt19937& random) {
+  std::string result(digits, '0');
+  for (char& digit : result) {
+    digit = static_cast<char>('0' + random() % 10);
+  }
+  result[0] = static_cast<char>('1' + random() % 9);
+  return result;
+}
+
+BigInteger RandomNumber(size_t digits, std::mt19937& random) {
+  BigInteger result;
+  result.setByString(RandomDigits(digits, random));
+  return result;
+}
+
+size_t BitsOf(size_t digits) {
+  return static_cast<size_t>(static_cast<double>(digits) * kBitsPerDigit) + 1;
+}
+
+// 2^bits - 1: every limb is all ones, so carries run the whole length.
+BigInteger AllOnes(size_t bits) { return (BigInteger(1) << bits) - 1; }
+
+size_t LimbsOf(const BigInteger& number) {
+  return number.bitLength() / kLimbBits + 1;
+}
+
+// Consecutive Fibonacci numbers with about the given number of digits, the
+// worst case for Euclid-style gcd. Uses fast doubling.
+std::pair<BigInteger, BigInteger> Fibonacci(size_t digits) {
+  size_t index = static_cast<size_t>(static_cast<double>(digits) * 4.785) + 2;
+  BigInteger current = 0;
+  BigInteger next = 1;
+  for (size_t bit = sizeof(size_t) * 8; bit > 0; --bit) {
+    BigInteger doubled = current * (next * 2 - current);
+    BigInteger doubled_next = current * current + next * next;
+    if (((index >> (bit - 1)) & 1) != 0) {
+      current = doubled_next;
+      next = doubled + doubled_next;
+    } else {
+      current = std::move(doubled);
+      next = std::move(doubled_next);
+    }
+  }
+  return {std::move(current), std::move(next)};
+}
+
+template <typename Operation>
+Case BinaryCase(BigInteger first, BigInteger second, Operation operation) {
+  size_t limbs = LimbsOf(first) + LimbsOf(second);
+  auto operands = std::make_shared<std::pair<BigInteger, BigInteger>>(
+      std::move(first), std::move(second));
+  return {[operands, operation] {
+            operation(operands->first, operands->second);
+          },
+          limbs};
+}
+
+Rational MakeRational(const BigInteger& nominator,
+                      const BigInteger& denominator) {
+  Rational result(nominator);
+  result /= Rational(denominator);
+  return result;
+}
+
+std::vector<Benchmark> MakeBenchmarks() {
+  std::vector<Benchmark> benchmarks;
+  benchmarks.push_back(
+      {"add", 1000000, [](size_t digits, bool is_adversarial,
+                          std::mt19937& random) {
+         BigInteger first = is_adversarial ? AllOnes(BitsOf(digits))
+                                           : RandomNumber(digits, random);
+         BigInteger second =
+             is_adversarial ? BigInteger(1) : RandomNumber(digits, random);
+         return BinaryCase(first, second,
+                           [](const BigInteger& a, const BigInteger& b) {
+                             BigInteger result = a + b;
+                           });
+       }});
+  benchmarks.push_back(
+      {"sub", 1000000, [](size_t digits, bool is_adversarial,
+                          std::mt19937& random) {
+         BigInteger first = is_adversarial ? BigInteger(1) << BitsOf(digits)
+                                           : RandomNumber(digits, random);
+         BigInteger second =
+             is_adversarial ? BigInteger(1) : RandomNumber(digits, random);
+         return BinaryCase(first, second,
+                           [](const BigInteger& a, const BigInteger& b) {
+                             BigInteger result = a - b;
+                           });
+       }});
+  benchmarks.push_back(
+      {"mul", 1000000, [](size_t digits, bool is_adversarial,
+                          std::mt19937& random) {
+         BigInteger first = is_adversarial ? AllOnes(BitsOf(digits))
+                                           : RandomNumber(digits, random);
+         BigInteger second = is_adversarial ? AllOnes(BitsOf(digits))
+                                            : RandomNumber(digits, random);
+         return BinaryCase(first, second,
+                           [](const BigInteger& a, const BigInteger& b) {
+                             BigInteger result = a * b;
+                           });
+       }});
+  // Division takes a 2n-digit dividend and an n-digit divider. The
+  // adversarial divider 2^(bits - 1) + 1 with an all-ones quotient and the
+  // largest remainder forces quotient digit corrections.
+  auto division_operands = [](size_t digits, bool is_adversarial,
+                              std::mt19937& random) {
+    if (!is_adversarial) {
+      return std::make_pair(RandomNumber(2 * digits, random),
+                            RandomNumber(digits, random));
+    }
+    size_t bits = BitsOf(digits);
+    BigInteger divider = (BigInteger(1) << (bits - 1)) + 1;
+    BigInteger dividend = divider * AllOnes(bits) + (divider - 1);
+    return std::make_pair(std::move(dividend), std::move(divider));
+  };
+  benchmarks.push_back(
+      {"div", 1000000, [division_operands](size_t digits, bool is_adversarial,
+                                           std::mt19937& random) {
+         auto operands = division_operands(digits, is_adversarial, random);
+         return BinaryCase(operands.first, operands.second,
+                           [](const BigInteger& a, const BigInteger& b) {
+                             BigInteger result = a / b;
+                           });
+       }});
+  benchmarks.push_back(
+      {"mod", 1000000, [division_operands](size_t digits, bool is_adversarial,
+                                           std::mt19937& random) {
+         auto operands = division_operands(digits, is_adversarial, random);
+         return BinaryCase(operands.first, operands.second,
+                           [](const BigInteger& a, const BigInteger& b) {
+                             BigInteger result = a % b;
+                           });
+       }});
+  benchmarks.push_back(
+      {"gcd", 100000, [](size_t digits, bool is_adversarial,
+                         std::mt19937& random) {
+         auto operands = is_adversarial
+                             ? Fibonacci(digits)
+                             : std::make_pair(RandomNumber(digits, random),
+                                              RandomNumber(digits, random));
+         return BinaryCase(operands.first, operands.second,
+                           [](const BigInteger& a, const BigInteger& b) {
+                             BigInteger result = Gcd(a, b);
+                           });
+       }});
+  benchmarks.push_back(
+      {"to_string", 1000000, [](size_t digits, bool is_adversarial,
+                                std::mt19937& random) {
+         BigInteger number = is_adversarial ? AllOnes(BitsOf(digits))
+                                            : RandomNumber(digits, random);
+         return BinaryCase(number, 0,
+                           [](const BigInteger& a, const BigInteger&) {
+                             std::string result = a.toString();
+                           });
+       }});
+  benchmarks.push_back(
+      {"from_string", 1000000, [](size_t digits, bool is_adversarial,
+                                  std::mt19937& random) {
+         auto text = std::make_shared<std::string>(
+             is_adversarial ? std::string(digits, '9')
+                            : RandomDigits(digits, random));
+         BigInteger number;
+         number.setByString(*text);
+         return Case{[text] {
+                       BigInteger result;
+                       result.setByString(*text);
+                     },
+                     LimbsOf(number)};
+       }});
+  // Rational operands have n-digit nominators and denominators; the
+  // adversarial ones are ratios of consecutive Fibonacci numbers, which are
+  // already reduced and make every gcd run the full length.
+  auto rational_operands = [](size_t digits, bool is_adversarial,
+                              std::mt19937& random) {
+    if (is_adversarial) {
+      auto first = Fibonacci(digits);
+      auto second = Fibonacci(digits + 1);
+      return std::make_pair(MakeRational(first.first, first.second),
+                            MakeRational(second.second, second.first));
+    }
+    return std::make_pair(MakeRational(RandomNumber(digits, random),
+                                       RandomNumber(digits, random)),
+                          MakeRational(RandomNumber(digits, random),
+                                       RandomNumber(digits, random)));
+  };
+  auto rational_case = [](std::pair<Rational, Rational> operands,
+                          std::function<void(const Rational&,
+                                             const Rational&)> operation) {
+    size_t limbs = 2 * (LimbsOf(operands.first.getNom()) +
+                        LimbsOf(operands.first.getDenominator()));
+    auto shared = std::make_shared<std::pair<Rational, Rational>>(
+        std::move(operands));
+    return Case{[shared, operation] {
+                  operation(shared->first, shared->second);
+                },
+                limbs};
+  };
+  benchmarks.push_back(
+      {"rational_add", 10000,
+       [rational_operands, rational_case](size_t digits, bool is_adversarial,
+                                          std::mt19937& random) {
+         return rational_case(
+             rational_operands(digits, is_adversarial, random),
+             [](const Rational& a, const Rational& b) {
+               Rational result = a + b;
+             });
+       }});
+  benchmarks.push_back(
+      {"rational_mul", 10000,
+       [rational_operands, rational_case](size_t digits, bool is_adversarial,
+                                          std::mt19937& random) {
+         return rational_case(
+             rational_operands(digits, is_adversarial, random),
+             [](const Rational& a, const Rational& b) {
+               Rational result = a * b;
+             });
+       }});
+  benchmarks.push_back(
+      {"as_decimal", 100000,
+       [rational_operands, rational_case](size_t digits, bool is_adversarial,
+                                          std::mt19937& random) {
+         return rational_case(
+             rational_operands(digits, is_adversarial, random),
+             [digits](const Rational& a, const Rational&) {
+               std::string result = a.asDecimal(digits);
+             });
+       }});
+  return benchmarks;
+}
+
+// Repeats the case, doubling the batch until it runs for min_seconds.
+// Allocations are counted in a separate untimed run: the timed runs use the
+// default allocation path and may multiply in parallel, which is disabled
+// inside a MemoryResourceScope.
+Measurement Measure(const Benchmark& benchmark, const Case& test_case,
+                    size_t digits, bool is_adversarial, double min_seconds) {
+  size_t allocations = 0;
+  {
+    CountingResource resource;
+    MemoryResourceScope scope(&resource);
+    test_case.run();
+    allocations = resource.allocations();
+  }
+  test_case.run();
+  size_t iterations = 1;
+  while (true) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t counter = 0; counter < iterations; ++counter) {
+      test_case.run();
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    if (seconds >= min_seconds) {
+      double per_operation = seconds / static_cast<double>(iterations);
+      return {benchmark.name,
+              is_adversarial ? "adversarial" : "random",
+              digits,
+              iterations,
+              per_operation * 1e9,
+              static_cast<double>(allocations),
+              static_cast<double>(test_case.limbs) / per_operation};
+    }
+    iterations *= 2;
+  }
+}
+
+void WriteCsv(std::ostream& out, const std::vector<Measurement>& results) {
+  out << "operation,input,digits,iterations,ns_per_op,"
+         "limb_allocations_per_op,limbs_per_second\n";
+  for (const Measurement& result : results) {
+    out << result.operation << ',' << result.input << ',' << result.digits
+        << ',' << result.iterations << ',' << result.nanoseconds_per_operation
+        << ',' << result.allocations_per_operation << ','
+        << result.limbs_per_second << '\n';
+  }
+}
+
+void WriteJson(std::ostream& out, const std::vector<Measurement>& results) {
+  out << "[\n";
+  for (size_t index = 0; index < results.size(); ++index) {
+    const Measurement& result = results[index];
+    out << "  {\"operation\": \"" << result.operation << "\", \"input\": \""
+        << result.input << "\", \"digits\": " << result.digits
+        << ", \"iterations\": " << result.iterations
+        << ", \"ns_per_op\": " << result.nanoseconds_per_operation
+        << ", \"limb_allocations_per_op\": "
+        << result.allocations_per_operation
+        << ", \"limbs_per_second\": " << result.limbs_per_second << "}"
+        << (index + 1 < results.size() ? "," : "") << '\n';
+  }
+  out << "]\n";
+}
+
+int main(int argc, char** argv) {
+  bool is_json = false;
+  std::string output_path;
+  std::string filter;
+  size_t max_digits = 1000000;
+  double step = 2;
+  double min_seconds = 0.1;
+  // Settings left unset keep BigInteger's current values.
+  std::optional<size_t> karatsuba_threshold;
+  std::optional<size_t> toom_cook_threshold;
+  std::optional<size_t> number_theoretic_threshold;
+  std::optional<size_t> division_threshold;
+  std::optional<size_t> threads;
+  std::optional<size_t> parallel_threshold;
+  for (int index = 1; index < argc; ++index) {
+    std::string argument = argv[index];
+    bool has_value = index + 1 < argc;
+    if (argument == "--json") {
+      is_json = true;
+    } else if (argument == "--output" && has_value) {
+      output_path = argv[++index];
+    } else if (argument == "--filter" && has_value) {
+      filter = argv[++index];
+    } else if (argument == "--max-digits" && has_value) {
+      max_digits = std::strtoull(argv[++index], nullptr, 10);
+    } else if (argument == "--step" && has_value) {
+      step = std::strtod(argv[++index], nullptr);
+    } else if (argument == "--min-time" && has_value) {
+      min_seconds = std::strtod(argv[++index], nullptr);
+    } else if (argument == "--karatsuba" && has_value) {
+      karatsuba_threshold = std::strtoull(argv[++index], nullptr, 10);
+    } else if (argument == "--toom" && has_value) {
+      toom_cook_threshold = std::strtoull(argv[++index], nullptr, 10);
+    } else if (argument == "--ntt" && has_value) {
+      number_theoretic_threshold = std::strtoull(argv[++index], nullptr, 10);
+    } else if (argument == "--division" && has_value) {
+      division_threshold = std::strtoull(argv[++index], nullptr, 10);
+    } else if (argument == "--threads" && has_value) {
+      threads = std::strtoull(argv[++index], nullptr, 10);
+    } else if (argument == "--parallel-threshold" && has_value) {
+      parallel_threshold = std::strtoull(argv[++index], nullptr, 10);
+    } else {
+      std::cerr << "usage: " << argv[0] << kUsage;
+      return 1;
+    }
+  }
+  if (!(step > 1)) {
+    std::cerr << "--step must be greater than 1\n";
+    return 1;
+  }
+  std::ofstream file;
+  if (!output_path.empty()) {
+    file.open(output_path);
+    if (!file) {
+      std::cerr << "cannot open " << output_path << " for writing\n";
+      return 1;
+    }
+  }
+  if (karatsuba_threshold || toom_cook_threshold ||
+      number_theoretic_threshold) {
+    BigInteger::setMultiplicationThresholds(
+        karatsuba_threshold.value_or(BigInteger::getKaratsubaThreshold()),
+        toom_cook_threshold.value_or(BigInteger::getToomCookThreshold()),
+        number_theoretic_threshold.value_or(
+            BigInteger::getNumberTheoreticThreshold()));
+  }
+  if (division_threshold) {
+    BigInteger::setDivisionThreshold(*division_threshold);
+  }
+  if (threads || parallel_threshold) {
+    BigInteger::setMultiplicationThreads(
+        threads.value_or(BigInteger::getMultiplicationThreads()),
+        parallel_threshold.value_or(BigInteger::getParallelThreshold()));
+  }
+  std::mt19937 random(1);
+  std::vector<Measurement> results;
+  for (const Benchmark& benchmark : MakeBenchmarks()) {
+    if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    for (size_t digits = 1;
+         digits <= std::min(max_digits, benchmark.max_digits);
+         digits = std::max(digits + 1, static_cast<size_t>(
+                                           static_cast<double>(digits) * step))) {
+      for (bool is_adversarial : {false, true}) {
+        Case test_case = benchmark.prepare(digits, is_adversarial, random);
+        results.push_back(Measure(benchmark, test_case, digits,
+                                  is_adversarial, min_seconds));
+        std::cerr << benchmark.name << ' ' << results.back().input << ' '
+                  << digits << ": " << results.back().nanoseconds_per_operation
+                  << " ns/op\n";
+      }
+    }
+  }
+  std::ostream& out = output_path.empty() ? std::cout : file;
+  if (is_json) {
+    WriteJson(out, results);
+  } else {
+    WriteCsv(out, results);
+  }
+  return 0;
+}
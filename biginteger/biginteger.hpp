@@ -1,12 +1,31 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 class BigInteger;
 class Rational;
 
-BigInteger operator*(const BigInteger& first, const BigInteger& second);
-BigInteger operator/(const BigInteger& first, const BigInteger& second);
+BigInteger operator+(BigInteger first, const BigInteger& second);
+BigInteger operator-(BigInteger first, const BigInteger& second);
+BigInteger operator*(BigInteger first, const BigInteger& second);
+BigInteger operator/(BigInteger first, const BigInteger& second);
+BigInteger Pow(BigInteger base, size_t exponent);
 bool operator<(const BigInteger& first, const BigInteger& second);
 bool operator>(const BigInteger& first, const BigInteger& second);
 bool operator==(const BigInteger& first, const BigInteger& second);
@@ -14,220 +33,555 @@ bool operator<=(const BigInteger& first, const BigInteger& second);
 bool operator>=(const BigInteger& first, const BigInteger& second);
 bool operator!=(const BigInteger& first, const BigInteger& second);
 
-class BigInteger {
+// Limb array that keeps up to kInlineLimbs limbs (two 64-bit words) inside
+// the object and only allocates when a number outgrows them. Heap limbs come
+// from the memory resource current on this thread when the storage was
+// created (see MemoryResourceScope), or from new[] when there is none.
+class LimbStorage {
  public:
-  BigInteger() = default;
+  LimbStorage() = default;
 
-  BigInteger(int integer) {
-    if (integer >= 0) {
-      is_positive_ = true;
+  LimbStorage(size_t size, uint32_t value) { assign(size, value); }
+
+  LimbStorage(const LimbStorage& storage) {
+    assign(storage.begin(), storage.end());
+  }
+
+  // As in the move assignment below, limbs are only stolen within one
+  // resource: a value moved out of a scope gets its own copy of them (and an
+  // allocation failure while copying terminates).
+  LimbStorage(LimbStorage&& storage) noexcept {
+    if (resource_ != storage.resource_) {
+      assign(storage.begin(), storage.end());
+      return;
+    }
+    steal(storage);
+  }
+
+  LimbStorage& operator=(const LimbStorage& storage) {
+    if (this != &storage) {
+      assign(storage.begin(), storage.end());
+    }
+    return *this;
+  }
+
+  // Limbs are only stolen within one resource, so numbers that outlive a
+  // scope never keep pointers into its memory.
+  LimbStorage& operator=(LimbStorage&& storage) {
+    if (this == &storage) {
+      return *this;
+    }
+    if (resource_ != storage.resource_) {
+      assign(storage.begin(), storage.end());
+      return *this;
+    }
+    release();
+    steal(storage);
+    return *this;
+  }
+
+  ~LimbStorage() { release(); }
+
+  static std::pmr::memory_resource* currentResource() {
+    return current_resource_;
+  }
+
+  size_t size() const { return size_; }
+
+  uint32_t* data() { return limbs_; }
+
+  const uint32_t* data() const { return limbs_; }
+
+  uint32_t* begin() { return limbs_; }
+
+  uint32_t* end() { return limbs_ + size_; }
+
+  const uint32_t* begin() const { return limbs_; }
+
+  const uint32_t* end() const { return limbs_ + size_; }
+
+  uint32_t& operator[](size_t index) { return limbs_[index]; }
+
+  const uint32_t& operator[](size_t index) const { return limbs_[index]; }
+
+  uint32_t& back() { return limbs_[size_ - 1]; }
+
+  const uint32_t& back() const { return limbs_[size_ - 1]; }
+
+  void push_back(uint32_t limb) {
+    if (size_ == capacity_) {
+      reserve(2 * capacity_);
+    }
+    limbs_[size_] = limb;
+    ++size_;
+  }
+
+  void pop_back() { --size_; }
+
+  void resize(size_t size, uint32_t value = 0) {
+    if (size > size_) {
+      reserve(size);
+      std::fill(limbs_ + size_, limbs_ + size, value);
+    }
+    size_ = size;
+  }
+
+  void assign(size_t size, uint32_t value) {
+    size_ = 0;
+    resize(size, value);
+  }
+
+  void assign(const uint32_t* first, const uint32_t* last) {
+    size_ = 0;
+    reserve(static_cast<size_t>(last - first));
+    std::copy(first, last, limbs_);
+    size_ = static_cast<size_t>(last - first);
+  }
+
+  void insert(uint32_t* position, size_t count, uint32_t value) {
+    size_t offset = static_cast<size_t>(position - limbs_);
+    reserve(size_ + count);
+    std::copy_backward(limbs_ + offset, limbs_ + size_,
+                       limbs_ + size_ + count);
+    std::fill(limbs_ + offset, limbs_ + offset + count, value);
+    size_ += count;
+  }
+
+  void erase(uint32_t* first, uint32_t* last) {
+    std::copy(last, end(), first);
+    size_ -= static_cast<size_t>(last - first);
+  }
+
+  void reserve(size_t capacity) {
+    if (capacity <= capacity_) {
+      return;
+    }
+    uint32_t* limbs =
+        resource_ == nullptr
+            ? new uint32_t[capacity]
+            : static_cast<uint32_t*>(resource_->allocate(
+                  capacity * sizeof(uint32_t), alignof(uint32_t)));
+    std::copy(limbs_, limbs_ + size_, limbs);
+    release();
+    limbs_ = limbs;
+    capacity_ = capacity;
+  }
+
+ private:
+  void release() {
+    if (limbs_ != buffer_ && resource_ == nullptr) {
+      delete[] limbs_;
+    } else if (limbs_ != buffer_) {
+      resource_->deallocate(limbs_, capacity_ * sizeof(uint32_t),
+                            alignof(uint32_t));
+    }
+    limbs_ = buffer_;
+    capacity_ = kInlineLimbs;
+  }
+
+  void steal(LimbStorage& storage) {
+    if (storage.limbs_ == storage.buffer_) {
+      std::copy(storage.buffer_, storage.buffer_ + storage.size_, buffer_);
     } else {
-      is_positive_ = false;
-      integer = abs(integer);
+      limbs_ = storage.limbs_;
+      capacity_ = storage.capacity_;
+      storage.limbs_ = storage.buffer_;
+      storage.capacity_ = kInlineLimbs;
+    }
+    size_ = storage.size_;
+    storage.size_ = 0;
+  }
+
+  static const size_t kInlineLimbs = 4;
+  static inline thread_local std::pmr::memory_resource* current_resource_ =
+      nullptr;
+  std::pmr::memory_resource* resource_ = current_resource_;
+  uint32_t buffer_[kInlineLimbs];
+  uint32_t* limbs_ = buffer_;
+  size_t size_ = 0;
+  size_t capacity_ = kInlineLimbs;
+
+  friend class MemoryResourceScope;
+};
+
+// While alive, BigIntegers (and so Rationals) created on this thread take
+// their limbs from resource, e.g. a std::pmr::monotonic_buffer_resource that
+// is released after a whole elimination pass. Results that must outlive the
+// resource have to end up in numbers created outside it: copied or moved
+// after the scope ends, move-assigned, or constructed under a nested
+// MemoryResourceScope(nullptr), e.g. for a push_back into a longer-lived
+// container while the scope is still active.
+class MemoryResourceScope {
+ public:
+  explicit MemoryResourceScope(std::pmr::memory_resource* resource)
+      : previous_(LimbStorage::current_resource_) {
+    LimbStorage::current_resource_ = resource;
+  }
+
+  MemoryResourceScope(const MemoryResourceScope&) = delete;
+
+  MemoryResourceScope& operator=(const MemoryResourceScope&) = delete;
+
+  ~MemoryResourceScope() { LimbStorage::current_resource_ = previous_; }
+
+ private:
+  std::pmr::memory_resource* previous_;
+};
+
+// Worker threads shared by all parallel products. Workers are started on
+// demand up to the largest count asked for and joined at exit.
+class WorkerPool {
+ public:
+  static WorkerPool& instance() {
+    static WorkerPool pool;
+    return pool;
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      is_stopping_ = true;
+    }
+    has_job_.notify_all();
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  void submit(std::function<void()> job, size_t workers) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while (workers_.size() < workers) {
+        workers_.emplace_back([this] { work(); });
+      }
+      jobs_.push_back(std::move(job));
+    }
+    has_job_.notify_one();
+  }
+
+ private:
+  WorkerPool() = default;
+
+  void work() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        has_job_.wait(lock, [this] { return is_stopping_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+          return;
+        }
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      job();
     }
-    if (integer == 0) {
-      data_.push_back(0);
+  }
+
+  std::mutex mutex_;
+  std::condition_variable has_job_;
+  std::deque<std::function<void()>> jobs_;
+  std::vector<std::thread> workers_;
+  bool is_stopping_ = false;
+};
+
+class BigInteger {
+ public:
+  BigInteger() = default;
+
+  template <typename Integer,
+            typename = std::enable_if_t<std::is_integral_v<Integer>>>
+  BigInteger(Integer integer) {
+    uint64_t magnitude = static_cast<uint64_t>(integer);
+    if constexpr (std::is_signed_v<Integer>) {
+      if (integer < 0) {
+        is_positive_ = false;
+        magnitude = -magnitude;
+      }
     }
-    while (integer > 0) {
-      data_.push_back(static_cast<int8_t>(integer % kBase));
-      integer /= kBase;
+    setMagnitude(magnitude);
+  }
+
+  // Truncates toward zero; value must be finite.
+  template <typename Floating,
+            std::enable_if_t<std::is_floating_point_v<Floating>, int> = 0>
+  explicit BigInteger(Floating value) {
+    const int kDigits = std::min(std::numeric_limits<Floating>::digits, 64);
+    int exponent = 0;
+    Floating fraction = std::frexp(std::trunc(std::fabs(value)), &exponent);
+    setMagnitude(static_cast<uint64_t>(std::ldexp(fraction, kDigits)));
+    if (exponent >= kDigits) {
+      *this <<= static_cast<size_t>(exponent - kDigits);
+    } else {
+      *this >>= static_cast<size_t>(kDigits - exponent);
     }
+    is_positive_ = !(value < 0) || isZero();
   }
 
   std::string toString() const {
     std::string result;
+    writeDecimal(result);
+    return result;
+  }
+
+  // Nearest double, ties to even; too large numbers give infinity.
+  double toDouble() const {
+    double magnitude = roundedToDouble(0, false);
+    return is_positive_ ? magnitude : -magnitude;
+  }
+
+  // Appends the decimal form of *this to a std::string or a std::ostream.
+  // Large numbers are split by the cached powers 10^(9 * 2^k).
+  template <typename Output>
+  void writeDecimal(Output& output) const {
     if (!is_positive_) {
-      result.push_back('-');
+      writeChars(output, "-", 1);
     }
-    for (size_t index = 0; index < data_.size(); ++index) {
-      result.push_back(
-          static_cast<char>(data_[data_.size() - 1 - index] + '0'));
+    BigInteger magnitude = *this;
+    magnitude.is_positive_ = true;
+    if (data_.size() < kRadixConversionThreshold) {
+      magnitude.writeDecimalSchoolbook(output, 0);
+      return;
     }
-    return result;
+    size_t levels = 1;
+    while (data_.size() + 1 >= 2 * decimalPower(levels - 1).data_.size()) {
+      ++levels;
+    }
+    magnitude.writeDecimalRecursive(output, levels, 0);
   }
 
   bool isPositive() const { return is_positive_; }
 
-  bool isSmallerWithoutSign(const BigInteger& number) const {
-    if (data_.size() < number.data_.size()) {
-      return true;
+  // -1, 0 or 1.
+  int sign() const {
+    if (isZero()) {
+      return 0;
     }
-    if (data_.size() > number.data_.size()) {
-      return false;
+    return is_positive_ ? 1 : -1;
+  }
+
+  bool isSmallerWithoutSign(const BigInteger& number) const {
+    return compareWithoutSign(number) < 0;
+  }
+
+  // Three-way comparison of the magnitudes: -1, 0 or 1.
+  int compareWithoutSign(const BigInteger& number) const {
+    if (data_.size() != number.data_.size()) {
+      return data_.size() < number.data_.size() ? -1 : 1;
     }
     for (ssize_t index = static_cast<ssize_t>(data_.size() - 1); index > -1;
          --index) {
-      if (data_[index] < number.data_[index]) {
-        return true;
-      }
-      if (data_[index] > number.data_[index]) {
-        return false;
+      if (data_[index] != number.data_[index]) {
+        return data_[index] < number.data_[index] ? -1 : 1;
       }
     }
-    return false;
+    return 0;
   }
 
   void setByString(const std::string& str) {
-    data_.clear();
-    is_positive_ = true;
-    size_t str_size = str.size();
-    if (str[0] == '-') {
-      is_positive_ = false;
-      str_size -= 1;
+    size_t begin = 0;
+    if (!str.empty() && str[0] == '-') {
+      begin = 1;
     }
-    for (size_t index = 0; index < str_size; ++index) {
-      data_.push_back(static_cast<int8_t>(str[str.size() - 1 - index] - '0'));
+    size_t count = str.size() - begin;
+    if (count < kRadixConversionThreshold * kDecimalBaseDigits) {
+      readDecimalSchoolbook(str.data() + begin, count);
+    } else {
+      *this = readDecimalRecursive(str.data() + begin, count);
     }
+    is_positive_ = begin == 0;
+    correctMinusZero();
   }
 
   BigInteger& operator+=(const BigInteger& number) {
-    while (number.data_.size() > data_.size()) {
-      data_.push_back(0);
+    if (isWord() && number.isWord()) {
+      sumWords(number);
+      return *this;
     }
     if (is_positive_ == number.is_positive_) {
       sameSgnSum(number);
       return *this;
     }
-    if (!number.is_positive_) {
-      is_positive_ = false;
-      if (*this <= number) {
-        bigMinusSmall(number);
-        is_positive_ = true;
-        return *this;
-      }
+    if (isSmallerWithoutSign(number)) {
       smallMinusBig(number);
+      is_positive_ = number.is_positive_;
       return *this;
     }
-    is_positive_ = true;
-    if (*this >= number) {
-      bigMinusSmall(number);
-      if (data_.size() != 1 || data_[0] != 0) {
-        is_positive_ = false;
-      }
-      return *this;
-    }
-    smallMinusBig(number);
+    bigMinusSmall(number);
     return *this;
   }
 
   BigInteger& operator-=(const BigInteger& number) {
+    if (this == &number) {
+      *this = 0;
+      return *this;
+    }
     is_positive_ = !is_positive_;
     *this += number;
     is_positive_ = !is_positive_;
+    correctMinusZero();
     return *this;
   }
 
   BigInteger& operator*=(const BigInteger& number) {
-    BigInteger result;
-    int8_t buffer = 0;
-    for (size_t counter = 0; counter < data_.size() + number.data_.size();
-         ++counter) {
-      result.data_.push_back(0);
-    }
-    for (size_t first_index = 0; first_index < data_.size(); ++first_index) {
-      for (size_t second_index = 0; second_index < number.data_.size();
-           ++second_index) {
-        buffer = data_[first_index] * number.data_[second_index] +
-                 result.data_[first_index + second_index] + buffer;
-        result.data_[first_index + second_index] = buffer % kBase;
-        buffer /= kBase;
-      }
-      if (buffer > 0) {
-        result.data_[first_index + number.data_.size()] = buffer;
-      }
-      buffer = 0;
+    if (isWord() && number.isWord()) {
+      setMagnitude(static_cast<unsigned __int128>(toWord()) * number.toWord());
+      is_positive_ = (is_positive_ == number.is_positive_);
+      correctMinusZero();
+      return *this;
     }
+    BigInteger result = multiplyMagnitudes(*this, number);
     result.is_positive_ = (is_positive_ == number.is_positive_);
-    *this = result;
-    deleteZeros();
-    correctMinusZero();
+    result.correctMinusZero();
+    *this = std::move(result);
     return *this;
   }
 
-  void shiftExponent(int power) {
-    if (power > 0) {
-      for (size_t counter = 0; counter < static_cast<size_t>(power);
-           ++counter) {
-        data_.push_back(0);
-      }
-      for (size_t index = 0; index < data_.size() - power; ++index) {
-        std::swap(data_[data_.size() - 1 - index],
-                  data_[data_.size() - 1 - power - index]);
-      }
-    } else if (power < 0) {
-      power = -power;
-      for (size_t counter = 0; counter < static_cast<size_t>(power);
-           ++counter) {
-        data_[counter] = 0;
-      }
-      for (size_t index = power; index < data_.size(); ++index) {
-        std::swap(data_[index - power], data_[index]);
-      }
-      deleteZeros();
-    }
+  static void setMultiplicationThresholds(size_t karatsuba_threshold,
+                                          size_t toom_cook_threshold,
+                                          size_t number_theoretic_threshold) {
+    karatsuba_threshold_ = karatsuba_threshold > kMinThreshold
+                               ? karatsuba_threshold
+                               : kMinThreshold;
+    toom_cook_threshold_ =
+        std::max(toom_cook_threshold, karatsuba_threshold_.load());
+    number_theoretic_threshold_ =
+        std::max(number_theoretic_threshold, karatsuba_threshold_.load());
   }
 
-  void reverse() {
-    for (size_t index = 0; index < data_.size() / 2; ++index) {
-      std::swap(data_[index], data_[data_.size() - 1 - index]);
-    }
+  // Products whose shorter operand has at least parallel_threshold limbs
+  // spread their sub-products over the calling thread and a shared pool of
+  // threads - 1 workers (started once, kept until exit).
+  static void setMultiplicationThreads(size_t threads,
+                                       size_t parallel_threshold) {
+    thread_limit_ = threads > 1 ? threads : 1;
+    parallel_threshold_ = parallel_threshold > kMinThreshold
+                              ? parallel_threshold
+                              : kMinThreshold;
   }
 
-  BigInteger& operator/=(const BigInteger& number) {
-    BigInteger result;
-    if (this == &number) {
-      *this = 1;
-      return *this;
+  static void setDivisionThreshold(size_t division_threshold) {
+    division_threshold_ = division_threshold > kMinThreshold
+                              ? division_threshold
+                              : kMinThreshold;
+  }
+
+  static size_t getKaratsubaThreshold() { return karatsuba_threshold_; }
+
+  static size_t getToomCookThreshold() { return toom_cook_threshold_; }
+
+  static size_t getNumberTheoreticThreshold() {
+    return number_theoretic_threshold_;
+  }
+
+  static size_t getMultiplicationThreads() { return thread_limit_; }
+
+  static size_t getParallelThreshold() { return parallel_threshold_; }
+
+  // Multiplies by 10^power, or divides by 10^-power truncating toward zero.
+  void scaleByPow10(int power) {
+    size_t magnitude = power < 0 ? -static_cast<int64_t>(power) : power;
+    if (magnitude > kSmallScaleDigits) {
+      BigInteger scale = Pow(10, magnitude);
+      if (power > 0) {
+        *this *= scale;
+      } else {
+        *this /= scale;
+      }
+      return;
     }
-    if (data_.size() < number.data_.size()) {
-      result = 0;
-      *this = result;
-      return *this;
+    while (power > 0) {
+      int step = std::min(power, static_cast<int>(kDecimalBaseDigits));
+      multiplyBySmall(powerOfTen(step), 0);
+      power -= step;
     }
-    int8_t buffer = 0;
-    size_t shift = 0;
-    size_t initial_size = data_.size();
-    for (size_t counter = 0; counter < initial_size - number.data_.size() + 1;
-         ++counter) {
-      shift = initial_size - number.data_.size() - counter;
-      while (isDivisibleWithShift(number, shift)) {
-        minusWithShift(number, shift);
-        buffer += 1;
-      }
-      result.data_.push_back(buffer);
-      buffer = 0;
+    while (power < 0) {
+      int step = std::min(-power, static_cast<int>(kDecimalBaseDigits));
+      divideBySmall(powerOfTen(step));
+      power += step;
     }
-    result.is_positive_ = is_positive_ == number.is_positive_;
-    *this = result;
-    reverse();
-    deleteZeros();
     correctMinusZero();
+  }
+
+  // Bit shifts of the magnitude; right shifts truncate toward zero like
+  // operator/= by a power of two.
+  BigInteger& operator<<=(size_t bits) {
+    shiftBitsLeft(bits);
+    return *this;
+  }
+
+  BigInteger& operator>>=(size_t bits) {
+    shiftBitsRight(bits);
+    return *this;
+  }
+
+  BigInteger& operator/=(const BigInteger& number) {
+    *this = divMod(number);
     return *this;
   }
 
   BigInteger& operator%=(const BigInteger& number) {
+    divMod(number);
+    return *this;
+  }
+
+  // Replaces *this with the remainder and returns the quotient, both with the
+  // same truncating semantics as operator/= and operator%=.
+  BigInteger divMod(const BigInteger& number) {
     if (this == &number) {
       *this = 0;
-      return *this;
+      return 1;
     }
-    if (data_.size() < number.data_.size()) {
-      return *this;
+    BigInteger result;
+    if (isWord() && number.isWord()) {
+      uint64_t dividend = toWord();
+      uint64_t divider = number.toWord();
+      result.setMagnitude(dividend / divider);
+      setMagnitude(dividend % divider);
+    } else {
+      result = divideWithRemainder(number);
     }
-    size_t shift = 0;
-    size_t initial_size = data_.size();
-    for (size_t counter = 0; counter < initial_size - number.data_.size() + 1;
-         ++counter) {
-      shift = initial_size - number.data_.size() - counter;
-      while (isDivisibleWithShift(number, shift)) {
-        minusWithShift(number, shift);
-      }
+    result.is_positive_ = is_positive_ == number.is_positive_;
+    result.correctMinusZero();
+    correctMinusZero();
+    return result;
+  }
+
+  // *this += first * second without a temporary for the product when the
+  // signs agree and the operands are in the schoolbook range.
+  BigInteger& addMul(const BigInteger& first, const BigInteger& second) {
+    bool is_product_positive = first.is_positive_ == second.is_positive_;
+    if (isZero()) {
+      is_positive_ = is_product_positive;
     }
-    deleteZeros();
+    if (is_positive_ != is_product_positive || this == &first ||
+        this == &second ||
+        std::min(first.data_.size(), second.data_.size()) >=
+            karatsuba_threshold_) {
+      return *this += first * second;
+    }
+    accumulateProduct(first, second);
+    correctMinusZero();
+    return *this;
+  }
+
+  // *this -= first * second, see addMul.
+  BigInteger& subMul(const BigInteger& first, const BigInteger& second) {
+    if (this == &first || this == &second) {
+      return *this -= first * second;
+    }
+    is_positive_ = !is_positive_;
+    addMul(first, second);
+    is_positive_ = !is_positive_;
     correctMinusZero();
     return *this;
   }
 
-  explicit operator bool() const { return *this != 0; }
+  explicit operator bool() const { return !isZero(); }
 
   BigInteger& operator++() {
     *this += 1;
@@ -251,145 +605,1390 @@ class BigInteger {
     return result;
   }
 
-  BigInteger operator-() {
+  BigInteger operator-() const& {
     BigInteger result = *this;
-    result.is_positive_ = !is_positive_;
-    result.correctMinusZero();
+    result.changeSgn();
     return result;
   }
 
+  BigInteger operator-() && {
+    changeSgn();
+    return std::move(*this);
+  }
+
   void changeSgn() {
     is_positive_ = !is_positive_;
     correctMinusZero();
   }
 
- private:
-  void sameSgnSum(const BigInteger& number) {
-    int8_t buffer = 0;
-    for (size_t index = 0; index < number.data_.size(); ++index) {
-      buffer += data_[index] + number.data_[index];
-      data_[index] = buffer % kBase;
-      buffer /= kBase;
-    }
-    for (size_t index = number.data_.size(); index < data_.size(); ++index) {
-      buffer += data_[index];
-      data_[index] = buffer % kBase;
-      buffer /= kBase;
-    }
-    if (buffer > 0) {
-      data_.push_back(buffer);
+  // Bits and bit length refer to the magnitude.
+  bool testBit(size_t index) const {
+    if (index / kLimbBits >= data_.size()) {
+      return false;
     }
-    correctMinusZero();
+    return ((data_[index / kLimbBits] >> (index % kLimbBits)) & 1) != 0;
   }
 
-  void bigMinusSmall(const BigInteger& number) {
-    int8_t buffer = 0;
-    for (size_t index = 0; index < number.data_.size(); ++index) {
-      buffer += data_[index] - number.data_[index];
-      if (buffer < 0) {
-        data_[index] = buffer + kBase;
-        buffer = -1;
-      } else {
-        data_[index] = buffer;
-        buffer = 0;
-      }
-    }
-    for (size_t index = number.data_.size(); index < data_.size(); ++index) {
-      buffer += data_[index];
-      if (buffer < 0) {
-        data_[index] = buffer + kBase;
-        buffer = -1;
-      } else {
-        data_[index] = buffer;
-        buffer = 0;
-      }
+  size_t bitLength() const {
+    if (isZero()) {
+      return 0;
     }
-    deleteZeros();
-    correctMinusZero();
+    return data_.size() * kLimbBits - countLeadingZeros(data_.back());
   }
 
-  void smallMinusBig(const BigInteger& number) {
-    int8_t buffer = 0;
-    for (size_t index = 0; index < data_.size(); ++index) {
-      buffer += number.data_[index] - data_[index];
-      if (buffer < 0) {
-        data_[index] = buffer + kBase;
-        buffer = -1;
-      } else {
-        data_[index] = buffer;
-        buffer = 0;
-      }
+  friend BigInteger Gcd(const BigInteger& first, const BigInteger& second);
+  friend BigInteger ExtendedGcd(const BigInteger& first,
+                                const BigInteger& second,
+                                BigInteger& first_coefficient,
+                                BigInteger& second_coefficient);
+  friend std::vector<uint32_t> RemaindersByTree(
+      const BigInteger& number, const std::vector<uint32_t>& moduli);
+  friend bool IsPerfectPower(const BigInteger& number);
+  friend class MontgomeryContext;
+  friend class Rational;
+
+ private:
+  static uint32_t powerOfTen(int power) {
+    uint32_t result = 1;
+    for (int counter = 0; counter < power; ++counter) {
+      result *= 10;
     }
-    deleteZeros();
-    correctMinusZero();
+    return result;
   }
 
-  size_t deleteZeros() {
-    size_t counter = 0;
-    while (data_.back() == 0 && data_.size() != 1) {
-      data_.pop_back();
-      counter += 1;
-    }
-    return counter;
+  static void writeChars(std::string& output, const char* chars,
+                         size_t count) {
+    output.append(chars, count);
   }
 
-  bool isDivisibleWithShift(const BigInteger& number, size_t shift) {
-    if (data_.size() < number.data_.size() + shift) {
-      return false;
+  static void writeChars(std::ostream& output, const char* chars,
+                         size_t count) {
+    output.write(chars, static_cast<std::streamsize>(count));
+  }
+
+  // Writes |*this| < decimalPower(level - 1)^2 padded with zeros to width
+  // digits (no padding for zero width). Destroys the value.
+  template <typename Output>
+  void writeDecimalRecursive(Output& output, size_t level, size_t width) {
+    if (level == 0 || data_.size() < kRadixConversionThreshold) {
+      writeDecimalSchoolbook(output, width);
+      return;
     }
-    if (data_.size() > number.data_.size() + shift) {
-      return true;
+    size_t low_width = kDecimalBaseDigits << (level - 1);
+    const BigInteger& power = decimalPower(level - 1);
+    BigInteger high =
+        power.data_.size() < kReciprocalThreshold
+            ? divMod(power)
+            : divModByReciprocal(power, decimalReciprocal(level - 1));
+    if (width == 0 && high.isZero()) {
+      writeDecimalRecursive(output, level - 1, 0);
+      return;
     }
-    for (size_t counter = 0; counter < number.data_.size(); ++counter) {
-      if (data_[number.data_.size() + shift - counter - 1] <
-          number.data_[number.data_.size() - counter - 1]) {
-        return false;
+    high.writeDecimalRecursive(output, level - 1,
+                               width == 0 ? 0 : width - low_width);
+    writeDecimalRecursive(output, level - 1, low_width);
+  }
+
+  // 10^(9 * 2^level). The powers, and the reciprocals of the large ones, are
+  // cached per thread and reused by later conversions. They are built
+  // outside any MemoryResourceScope, so the cache never points into an
+  // arena, and a deque keeps references to them valid while it grows.
+  static const BigInteger& decimalPower(size_t level) {
+    static thread_local std::deque<BigInteger> powers;
+    if (level >= powers.size()) {
+      MemoryResourceScope scope(nullptr);
+      if (powers.empty()) {
+        powers.push_back(BigInteger(static_cast<uint32_t>(kDecimalBase)));
       }
-      if (data_[number.data_.size() + shift - counter - 1] >
-          number.data_[number.data_.size() - counter - 1]) {
-        return true;
+      while (level >= powers.size()) {
+        powers.push_back(powers.back() * powers.back());
       }
     }
-    return true;
+    return powers[level];
   }
 
-  void minusWithShift(const BigInteger& number, size_t shift) {
-    int8_t buffer = 0;
-    for (size_t index = 0; index < number.data_.size(); ++index) {
-      buffer += data_[index + shift] - number.data_[index];
-      if (buffer < 0) {
-        data_[index + shift] = buffer + kBase;
-        buffer = -1;
-      } else {
-        data_[index + shift] = buffer;
-        buffer = 0;
-      }
+  static const BigInteger& decimalReciprocal(size_t level) {
+    static thread_local std::deque<BigInteger> reciprocals;
+    if (level >= reciprocals.size()) {
+      MemoryResourceScope scope(nullptr);
+      reciprocals.resize(level + 1);
     }
-    for (size_t index = number.data_.size() + shift; index < data_.size();
-         ++index) {
-      buffer += data_[index];
-      if (buffer < 0) {
-        data_[index] = buffer + kBase;
-        buffer = -1;
-      } else {
-        data_[index] = buffer;
-        buffer = 0;
-      }
+    if (reciprocals[level].isZero()) {
+      MemoryResourceScope scope(nullptr);
+      reciprocals[level] = reciprocal(decimalPower(level));
     }
-    deleteZeros();
+    return reciprocals[level];
   }
 
-  void correctMinusZero() {
-    if (data_.size() == 1 && data_[0] == 0) {
-      is_positive_ = true;
+  // About 2^(2 * bits) / divider, where divider has bits bits, within a few
+  // units. Newton's step refines the reciprocal r of the leading half +
+  // guard bits: with e = 2^(bits + half) - divider * r it returns
+  // (r << (bits - half)) + r * e / 2^(2 * half).
+  static BigInteger reciprocal(const BigInteger& divider) {
+    size_t bits = divider.bitLength();
+    BigInteger result = 1;
+    if (bits <= kReciprocalExactBits) {
+      result <<= 2 * bits;
+      return result.divMod(divider);
     }
+    size_t half = bits / 2 + kReciprocalGuardBits;
+    BigInteger leading = divider;
+    leading >>= bits - half;
+    BigInteger approximation = reciprocal(leading);
+    result <<= bits + half;
+    result.subMul(divider, approximation);
+    // Bits of e below 2^(bits - half - guard) change the step by less than
+    // one unit.
+    size_t dropped = bits - half - kReciprocalGuardBits;
+    result >>= dropped;
+    result *= approximation;
+    result >>= 2 * half - dropped;
+    approximation <<= bits - half;
+    result += approximation;
+    return result;
   }
 
-  std::vector<int8_t> data_;
-  bool is_positive_ = true;
-  static const int8_t kBase = 10;
-};
-
+  // Barrett division of 0 <= *this < divider^2 with divider_reciprocal from
+  // reciprocal(divider): two multiplications and a few corrections instead
+  // of a full division. Returns the quotient and keeps the remainder.
+  BigInteger divModByReciprocal(const BigInteger& divider,
+                                const BigInteger& divider_reciprocal) {
+    size_t bits = divider.bitLength();
+    BigInteger quotient = *this;
+    quotient >>= bits - 1;
+    quotient *= divider_reciprocal;
+    quotient >>= bits + 1;
+    subMul(quotient, divider);
+    while (!is_positive_) {
+      *this += divider;
+      quotient -= 1;
+    }
+    while (compareWithoutSign(divider) >= 0) {
+      *this -= divider;
+      quotient += 1;
+    }
+    return quotient;
+  }
+
+  template <typename Output>
+  void writeDecimalSchoolbook(Output& output, size_t width) {
+    std::string digits;
+    do {
+      uint32_t chunk = divideBySmall(kDecimalBase);
+      for (size_t counter = 0; counter < kDecimalBaseDigits; ++counter) {
+        digits.push_back(static_cast<char>(chunk % 10 + '0'));
+        chunk /= 10;
+      }
+    } while (!isZero());
+    while (digits.size() > std::max<size_t>(width, 1) && digits.back() == '0') {
+      digits.pop_back();
+    }
+    digits.resize(std::max(width, digits.size()), '0');
+    std::reverse(digits.begin(), digits.end());
+    writeChars(output, digits.data(), digits.size());
+  }
+
+  static BigInteger readDecimalRecursive(const char* digits, size_t count) {
+    BigInteger result;
+    if (count < kRadixConversionThreshold * kDecimalBaseDigits) {
+      result.readDecimalSchoolbook(digits, count);
+      return result;
+    }
+    size_t level = 0;
+    while ((kDecimalBaseDigits << (level + 1)) < count) {
+      ++level;
+    }
+    size_t low_count = kDecimalBaseDigits << level;
+    result = readDecimalRecursive(digits + count - low_count, low_count);
+    result.addMul(readDecimalRecursive(digits, count - low_count),
+                  decimalPower(level));
+    return result;
+  }
+
+  void readDecimalSchoolbook(const char* digits, size_t count) {
+    data_.assign(1, 0);
+    size_t index = 0;
+    while (index < count) {
+      uint32_t chunk = 0;
+      uint32_t multiplier = 1;
+      for (size_t counter = 0; counter < kDecimalBaseDigits && index < count;
+           ++counter, ++index) {
+        chunk = chunk * 10 + static_cast<uint32_t>(digits[index] - '0');
+        multiplier *= 10;
+      }
+      multiplyBySmall(multiplier, chunk);
+    }
+  }
+
+  bool isZero() const { return data_.size() == 1 && data_[0] == 0; }
+
+  bool isWord() const { return data_.size() <= 2; }
+
+  // Stores *this in value if it fits into int64_t (INT64_MIN excluded).
+  bool toInt64(int64_t& value) const {
+    if (!isWord() || toWord() > static_cast<uint64_t>(INT64_MAX)) {
+      return false;
+    }
+    value = static_cast<int64_t>(toWord());
+    if (!is_positive_) {
+      value = -value;
+    }
+    return true;
+  }
+
+  uint64_t toWord() const {
+    if (data_.size() == 1) {
+      return data_[0];
+    }
+    return (static_cast<uint64_t>(data_[1]) << kLimbBits) | data_[0];
+  }
+
+  // Nearest double to |*this| * 2^exponent, ties to even, subnormals
+  // included. inexact means the exact value was truncated to this and is a
+  // little larger; it only matters when at least one bit is rounded off.
+  double roundedToDouble(ptrdiff_t exponent, bool inexact) const {
+    const ptrdiff_t kMantissaBits = std::numeric_limits<double>::digits;
+    const ptrdiff_t kMinExponent =
+        std::numeric_limits<double>::min_exponent - kMantissaBits;
+    const ptrdiff_t kMaxExponent = 2 * std::numeric_limits<double>::max_exponent;
+    ptrdiff_t bits = static_cast<ptrdiff_t>(bitLength());
+    // Bits below 2^drop are rounded off.
+    ptrdiff_t drop = std::max(bits - kMantissaBits, kMinExponent - exponent);
+    if (drop <= 0) {
+      return std::ldexp(static_cast<double>(toWord()),
+                        static_cast<int>(exponent));
+    }
+    uint64_t kept = drop < bits
+                        ? bitsSlice(static_cast<size_t>(drop),
+                                    static_cast<size_t>(bits - drop))
+                              .toWord()
+                        : 0;
+    bool is_half = testBit(static_cast<size_t>(drop - 1));
+    bool is_above_half = inexact;
+    size_t half_index = static_cast<size_t>(drop - 1);
+    for (size_t index = 0;
+         !is_above_half && index < std::min(half_index / kLimbBits,
+                                            data_.size());
+         ++index) {
+      is_above_half = data_[index] != 0;
+    }
+    if (!is_above_half && half_index / kLimbBits < data_.size()) {
+      uint32_t below = (static_cast<uint32_t>(1) << (half_index % kLimbBits)) - 1;
+      is_above_half = (data_[half_index / kLimbBits] & below) != 0;
+    }
+    if (is_half && (is_above_half || kept % 2 == 1)) {
+      ++kept;
+    }
+    return std::ldexp(static_cast<double>(kept),
+                      static_cast<int>(std::min(exponent + drop, kMaxExponent)));
+  }
+
+  void setMagnitude(unsigned __int128 magnitude) {
+    data_.assign(1, static_cast<uint32_t>(magnitude));
+    magnitude >>= kLimbBits;
+    while (magnitude > 0) {
+      data_.push_back(static_cast<uint32_t>(magnitude));
+      magnitude >>= kLimbBits;
+    }
+  }
+
+  void sumWords(const BigInteger& number) {
+    uint64_t first = toWord();
+    uint64_t second = number.toWord();
+    if (is_positive_ == number.is_positive_) {
+      setMagnitude(static_cast<unsigned __int128>(first) + second);
+    } else if (first >= second) {
+      setMagnitude(first - second);
+    } else {
+      setMagnitude(second - first);
+      is_positive_ = number.is_positive_;
+    }
+    correctMinusZero();
+  }
+
+  void sameSgnSum(const BigInteger& number) {
+    plusWithShift(number, 0);
+    correctMinusZero();
+  }
+
+  void bigMinusSmall(const BigInteger& number) {
+    minusWithShift(number, 0);
+    correctMinusZero();
+  }
+
+  void smallMinusBig(const BigInteger& number) {
+    data_.resize(number.data_.size(), 0);
+    subtractLimbs(data_.data(), number.data_.data(), data_.data(),
+                  data_.size());
+    deleteZeros();
+    correctMinusZero();
+  }
+
+  size_t deleteZeros() {
+    size_t counter = 0;
+    while (data_.back() == 0 && data_.size() != 1) {
+      data_.pop_back();
+      counter += 1;
+    }
+    return counter;
+  }
+
+  // Carry-propagating kernels over raw limb arrays; result may alias either
+  // operand. Limbs are taken in pairs so the compiler emits one 64-bit
+  // add-with-carry (or subtract-with-borrow) chain instead of a 32-bit one.
+  static uint64_t addLimbs(uint32_t* result, const uint32_t* first,
+                           const uint32_t* second, size_t size) {
+    unsigned __int128 buffer = 0;
+    size_t index = 0;
+    for (; index + 1 < size; index += 2) {
+      buffer += static_cast<unsigned __int128>(pairAt(first, index)) +
+                pairAt(second, index);
+      storePair(result, index, static_cast<uint64_t>(buffer));
+      buffer >>= 2 * kLimbBits;
+    }
+    uint64_t carry = static_cast<uint64_t>(buffer);
+    if (index < size) {
+      carry += static_cast<uint64_t>(first[index]) + second[index];
+      result[index] = static_cast<uint32_t>(carry);
+      carry >>= kLimbBits;
+    }
+    return carry;
+  }
+
+  static uint64_t subtractLimbs(uint32_t* result, const uint32_t* first,
+                                const uint32_t* second, size_t size) {
+    unsigned __int128 buffer = 0;
+    size_t index = 0;
+    for (; index + 1 < size; index += 2) {
+      buffer = static_cast<unsigned __int128>(pairAt(first, index)) -
+               pairAt(second, index) - buffer;
+      storePair(result, index, static_cast<uint64_t>(buffer));
+      buffer >>= 4 * kLimbBits - 1;
+    }
+    uint64_t borrow = static_cast<uint64_t>(buffer);
+    if (index < size) {
+      borrow = static_cast<uint64_t>(first[index]) - second[index] - borrow;
+      result[index] = static_cast<uint32_t>(borrow);
+      borrow >>= kBorrowShift;
+    }
+    return borrow;
+  }
+
+  static uint64_t pairAt(const uint32_t* limbs, size_t index) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t pair;
+    std::memcpy(&pair, limbs + index, sizeof(pair));
+    return pair;
+#else
+    return (static_cast<uint64_t>(limbs[index + 1]) << kLimbBits) |
+           limbs[index];
+#endif
+  }
+
+  static void storePair(uint32_t* limbs, size_t index, uint64_t pair) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    std::memcpy(limbs + index, &pair, sizeof(pair));
+#else
+    limbs[index] = static_cast<uint32_t>(pair);
+    limbs[index + 1] = static_cast<uint32_t>(pair >> kLimbBits);
+#endif
+  }
+
+  void plusWithShift(const BigInteger& number, size_t shift) {
+    size_t number_size = number.data_.size();
+    if (data_.size() < number_size + shift) {
+      data_.resize(number_size + shift, 0);
+    }
+    uint32_t* values = data_.data() + shift;
+    uint64_t buffer = addLimbs(values, values, number.data_.data(), number_size);
+    for (size_t index = number_size + shift;
+         index < data_.size() && buffer > 0; ++index) {
+      buffer += data_[index];
+      data_[index] = static_cast<uint32_t>(buffer);
+      buffer >>= kLimbBits;
+    }
+    if (buffer > 0) {
+      data_.push_back(static_cast<uint32_t>(buffer));
+    }
+    deleteZeros();
+  }
+
+  void minusWithShift(const BigInteger& number, size_t shift) {
+    uint32_t* values = data_.data() + shift;
+    uint64_t buffer = subtractLimbs(values, values, number.data_.data(),
+                                    number.data_.size());
+    for (size_t index = number.data_.size() + shift;
+         index < data_.size() && buffer > 0; ++index) {
+      buffer = static_cast<uint64_t>(data_[index]) - buffer;
+      data_[index] = static_cast<uint32_t>(buffer);
+      buffer >>= kBorrowShift;
+    }
+    deleteZeros();
+  }
+
+  void multiplyBySmall(uint32_t multiplier, uint32_t addend) {
+    uint64_t buffer = addend;
+    for (size_t index = 0; index < data_.size(); ++index) {
+      buffer += static_cast<uint64_t>(data_[index]) * multiplier;
+      data_[index] = static_cast<uint32_t>(buffer);
+      buffer >>= kLimbBits;
+    }
+    if (buffer > 0) {
+      data_.push_back(static_cast<uint32_t>(buffer));
+    }
+    deleteZeros();
+  }
+
+  uint32_t divideBySmall(uint32_t divider) {
+    uint64_t buffer = 0;
+    for (size_t index = data_.size(); index > 0; --index) {
+      buffer = (buffer << kLimbBits) | data_[index - 1];
+      data_[index - 1] = static_cast<uint32_t>(buffer / divider);
+      buffer %= divider;
+    }
+    deleteZeros();
+    return static_cast<uint32_t>(buffer);
+  }
+
+  BigInteger limbsSlice(size_t begin, size_t count) const {
+    BigInteger result;
+    if (begin >= data_.size()) {
+      return result;
+    }
+    size_t end = std::min(begin + count, data_.size());
+    result.data_.assign(data_.begin() + begin, data_.begin() + end);
+    result.deleteZeros();
+    return result;
+  }
+
+  // Runs task(0), ..., task(count - 1) for one product of the given size.
+  // In parallel mode up to thread_limit_ - 1 pool workers help the calling
+  // thread: everyone claims the next unstarted index, so the caller only
+  // ever waits for tasks that are already running and nested calls cannot
+  // deadlock. The first exception thrown by a task is rethrown here once all
+  // of them have finished. pmr arenas are not thread-safe, so nothing is
+  // handed off inside a MemoryResourceScope.
+  template <typename Task>
+  static void runTasks(size_t count, size_t size, const Task& task) {
+    if (count < 2 || !isParallel(size)) {
+      for (size_t index = 0; index < count; ++index) {
+        task(index);
+      }
+      return;
+    }
+    struct Batch {
+      std::atomic<size_t> next = 0;
+      std::atomic<size_t> finished = 0;
+      std::mutex mutex;
+      std::condition_variable is_done;
+      std::exception_ptr error;
+    };
+    auto batch = std::make_shared<Batch>();
+    // Helpers that start after the batch is done claim nothing and never
+    // touch task.
+    auto run = [batch, &task, count] {
+      for (size_t index = batch->next++; index < count;
+           index = batch->next++) {
+        try {
+          task(index);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(batch->mutex);
+          if (!batch->error) {
+            batch->error = std::current_exception();
+          }
+        }
+        if (++batch->finished == count) {
+          std::lock_guard<std::mutex> lock(batch->mutex);
+          batch->is_done.notify_all();
+        }
+      }
+    };
+    size_t workers = thread_limit_ - 1;
+    for (size_t helper = 0; helper < std::min(count - 1, workers); ++helper) {
+      WorkerPool::instance().submit(run, workers);
+    }
+    run();
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->is_done.wait(lock, [&] { return batch->finished == count; });
+    if (batch->error) {
+      std::rethrow_exception(batch->error);
+    }
+  }
+
+  // Number of blocks for count independent items of a product of the given
+  // size: one when serial, otherwise a few per thread so that blocks of
+  // uneven speed balance out, but none shorter than kMinBlockItems.
+  static size_t parallelBlocks(size_t count, size_t size) {
+    if (!isParallel(size)) {
+      return 1;
+    }
+    return std::max<size_t>(
+        1, std::min(thread_limit_ * kBlocksPerThread, count / kMinBlockItems));
+  }
+
+  // Runs body(begin, end) over consecutive blocks covering [0, count).
+  template <typename Body>
+  static void runBlocks(size_t count, size_t size, const Body& body) {
+    size_t blocks = parallelBlocks(count, size);
+    runTasks(blocks, size, [&](size_t block) {
+      body(count * block / blocks, count * (block + 1) / blocks);
+    });
+  }
+
+  static bool isParallel(size_t size) {
+    return thread_limit_ > 1 && size >= parallel_threshold_ &&
+           LimbStorage::currentResource() == nullptr;
+  }
+
+  // Multiplies |first| by |second|; the result is always non-negative.
+  static BigInteger multiplyMagnitudes(const BigInteger& first,
+                                       const BigInteger& second) {
+    bool is_first_longer = first.data_.size() >= second.data_.size();
+    const BigInteger& longer = is_first_longer ? first : second;
+    const BigInteger& shorter = is_first_longer ? second : first;
+    if (shorter.data_.size() < karatsuba_threshold_) {
+      return multiplySchoolbook(longer, shorter);
+    }
+    if (shorter.data_.size() >= number_theoretic_threshold_ &&
+        longer.data_.size() + shorter.data_.size() <= kMaxTransformSize) {
+      return multiplyNumberTheoretic(longer, shorter);
+    }
+    if (longer.data_.size() >= 2 * shorter.data_.size()) {
+      return multiplyUnbalanced(longer, shorter);
+    }
+    if (shorter.data_.size() < toom_cook_threshold_) {
+      return multiplyKaratsuba(longer, shorter);
+    }
+    return multiplyToomCook(longer, shorter);
+  }
+
+  static BigInteger multiplySchoolbook(const BigInteger& first,
+                                       const BigInteger& second) {
+    BigInteger result;
+    result.accumulateProduct(first, second);
+    return result;
+  }
+
+  // Adds |first| * |second| to |*this| in place.
+  void accumulateProduct(const BigInteger& first, const BigInteger& second) {
+    size_t second_size = second.data_.size();
+    if (data_.size() < first.data_.size() + second_size) {
+      data_.resize(first.data_.size() + second_size, 0);
+    }
+    for (size_t first_index = 0; first_index < first.data_.size();
+         ++first_index) {
+      uint64_t buffer = 0;
+      for (size_t second_index = 0; second_index < second_size;
+           ++second_index) {
+        buffer += static_cast<uint64_t>(first.data_[first_index]) *
+                      second.data_[second_index] +
+                  data_[first_index + second_index];
+        data_[first_index + second_index] = static_cast<uint32_t>(buffer);
+        buffer >>= kLimbBits;
+      }
+      for (size_t index = first_index + second_size; buffer > 0; ++index) {
+        if (index == data_.size()) {
+          data_.push_back(0);
+        }
+        buffer += data_[index];
+        data_[index] = static_cast<uint32_t>(buffer);
+        buffer >>= kLimbBits;
+      }
+    }
+    deleteZeros();
+  }
+
+  static BigInteger multiplyUnbalanced(const BigInteger& longer,
+                                       const BigInteger& shorter) {
+    BigInteger result;
+    size_t step = shorter.data_.size();
+    if (!isParallel(step)) {
+      for (size_t begin = 0; begin < longer.data_.size(); begin += step) {
+        result.plusWithShift(
+            multiplyMagnitudes(longer.limbsSlice(begin, step), shorter), begin);
+      }
+      return result;
+    }
+    // Only thread_limit_ chunk products are kept at a time.
+    size_t count = (longer.data_.size() + step - 1) / step;
+    std::vector<BigInteger> products(std::min<size_t>(count, thread_limit_));
+    for (size_t first = 0; first < count; first += products.size()) {
+      size_t batch = std::min(products.size(), count - first);
+      runTasks(batch, step, [&](size_t index) {
+        products[index] = multiplyMagnitudes(
+            longer.limbsSlice((first + index) * step, step), shorter);
+      });
+      for (size_t index = 0; index < batch; ++index) {
+        result.plusWithShift(products[index], (first + index) * step);
+      }
+    }
+    return result;
+  }
+
+  static BigInteger multiplyKaratsuba(const BigInteger& first,
+                                      const BigInteger& second) {
+    size_t half = (first.data_.size() + 1) / 2;
+    BigInteger first_low = first.limbsSlice(0, half);
+    BigInteger first_high = first.limbsSlice(half, half);
+    BigInteger second_low = second.limbsSlice(0, half);
+    BigInteger second_high = second.limbsSlice(half, half);
+    BigInteger low;
+    BigInteger high;
+    BigInteger middle;
+    if (isParallel(second.data_.size())) {
+      BigInteger first_sum = first_low + first_high;
+      BigInteger second_sum = second_low + second_high;
+      const BigInteger* factors[][2] = {{&first_low, &second_low},
+                                        {&first_high, &second_high},
+                                        {&first_sum, &second_sum}};
+      BigInteger* products[] = {&low, &high, &middle};
+      runTasks(3, second.data_.size(), [&](size_t index) {
+        *products[index] =
+            multiplyMagnitudes(*factors[index][0], *factors[index][1]);
+      });
+    } else {
+      low = multiplyMagnitudes(first_low, second_low);
+      high = multiplyMagnitudes(first_high, second_high);
+      first_low.plusWithShift(first_high, 0);
+      second_low.plusWithShift(second_high, 0);
+      middle = multiplyMagnitudes(first_low, second_low);
+    }
+    middle.minusWithShift(low, 0);
+    middle.minusWithShift(high, 0);
+    low.plusWithShift(middle, half);
+    low.plusWithShift(high, 2 * half);
+    return low;
+  }
+
+  // Toom-3 with evaluation points 0, 1, -1, -2, infinity and Bodrato's
+  // interpolation sequence.
+  static BigInteger multiplyToomCook(const BigInteger& first,
+                                     const BigInteger& second) {
+    size_t part = (first.data_.size() + 2) / 3;
+    BigInteger first_values[kToomCookPoints];
+    BigInteger second_values[kToomCookPoints];
+    first.evaluateToomCook(part, first_values);
+    second.evaluateToomCook(part, second_values);
+    BigInteger values[kToomCookPoints];
+    runTasks(kToomCookPoints, second.data_.size(), [&](size_t index) {
+      values[index] =
+          multiplyMagnitudes(first_values[index], second_values[index]);
+      values[index].is_positive_ =
+          first_values[index].is_positive_ == second_values[index].is_positive_;
+      values[index].correctMinusZero();
+    });
+    BigInteger third = values[3] - values[1];
+    third.divideBySmall(3);
+    BigInteger first_coefficient = values[1] - values[2];
+    first_coefficient.divideBySmall(2);
+    BigInteger second_coefficient = values[2] - values[0];
+    third = second_coefficient - third;
+    third.divideBySmall(2);
+    third += values[4];
+    third += values[4];
+    second_coefficient += first_coefficient;
+    second_coefficient -= values[4];
+    first_coefficient -= third;
+    BigInteger result = std::move(values[0]);
+    result.plusWithShift(first_coefficient, part);
+    result.plusWithShift(second_coefficient, 2 * part);
+    result.plusWithShift(third, 3 * part);
+    result.plusWithShift(values[4], 4 * part);
+    return result;
+  }
+
+  void evaluateToomCook(size_t part, BigInteger* values) const {
+    BigInteger low = limbsSlice(0, part);
+    BigInteger middle = limbsSlice(part, part);
+    BigInteger high = limbsSlice(2 * part, part);
+    BigInteger sum = low + high;
+    values[1] = sum + middle;
+    values[2] = sum - middle;
+    values[3] = values[2] + high;
+    values[3] += values[3];
+    values[3] -= low;
+    values[0] = std::move(low);
+    values[4] = std::move(high);
+  }
+
+  // Convolution modulo three NTT-friendly primes, recombined with Garner's
+  // algorithm. The product of the primes exceeds kMaxTransformSize / 2 *
+  // (2^32)^2, so every coefficient is restored exactly.
+  static BigInteger multiplyNumberTheoretic(const BigInteger& first,
+                                            const BigInteger& second) {
+    size_t size = 1;
+    while (size < first.data_.size() + second.data_.size()) {
+      size <<= 1;
+    }
+    std::unique_ptr<uint32_t[]> residues[3];
+    runTasks(3, second.data_.size(), [&](size_t index) {
+      if (index == 0) {
+        residues[0] = convolveModulo<kFirstModulo>(first, second, size);
+      } else if (index == 1) {
+        residues[1] = convolveModulo<kSecondModulo>(first, second, size);
+      } else {
+        residues[2] = convolveModulo<kThirdModulo>(first, second, size);
+      }
+    });
+    const uint32_t* first_residues = residues[0].get();
+    const uint32_t* second_residues = residues[1].get();
+    const uint32_t* third_residues = residues[2].get();
+    const uint64_t first_inverse =
+        powerModulo<kSecondModulo>(kFirstModulo, kSecondModulo - 2);
+    const uint64_t second_inverse = powerModulo<kThirdModulo>(
+        static_cast<uint64_t>(kFirstModulo) * kSecondModulo % kThirdModulo,
+        kThirdModulo - 2);
+    const uint64_t moduli_product =
+        static_cast<uint64_t>(kFirstModulo) * kSecondModulo;
+    BigInteger result;
+    size_t result_size = first.data_.size() + second.data_.size();
+    result.data_.assign(result_size, 0);
+    // Each block restores its coefficients with a local carry; the carries
+    // out of the blocks are added afterwards.
+    size_t blocks = parallelBlocks(result_size, second.data_.size());
+    std::vector<unsigned __int128> carries(blocks);
+    runTasks(blocks, second.data_.size(), [&](size_t block) {
+      unsigned __int128 buffer = 0;
+      for (size_t index = result_size * block / blocks;
+           index < result_size * (block + 1) / blocks; ++index) {
+        uint64_t first_part = first_residues[index];
+        uint64_t second_part = (second_residues[index] + kSecondModulo -
+                                first_part % kSecondModulo) *
+                               first_inverse % kSecondModulo;
+        uint64_t partial = first_part + second_part * kFirstModulo;
+        uint64_t third_part =
+            (third_residues[index] + kThirdModulo - partial % kThirdModulo) *
+            second_inverse % kThirdModulo;
+        buffer += partial;
+        buffer += static_cast<unsigned __int128>(moduli_product) * third_part;
+        result.data_[index] = static_cast<uint32_t>(buffer);
+        buffer >>= kLimbBits;
+      }
+      carries[block] = buffer;
+    });
+    for (size_t block = 0; block + 1 < blocks; ++block) {
+      unsigned __int128 buffer = carries[block];
+      for (size_t index = result_size * (block + 1) / blocks; buffer > 0;
+           ++index) {
+        buffer += result.data_[index];
+        result.data_[index] = static_cast<uint32_t>(buffer);
+        buffer >>= kLimbBits;
+      }
+    }
+    result.deleteZeros();
+    return result;
+  }
+
+  // The arrays are left uninitialized and every item is written inside the
+  // parallel blocks, zero padding included.
+  template <uint32_t modulo>
+  static std::unique_ptr<uint32_t[]> convolveModulo(const BigInteger& first,
+                                                    const BigInteger& second,
+                                                    size_t size) {
+    std::unique_ptr<uint32_t[]> first_values(new uint32_t[size]);
+    std::unique_ptr<uint32_t[]> second_values(new uint32_t[size]);
+    size_t parallel_size = second.data_.size();
+    const BigInteger* factors[] = {&first, &second};
+    uint32_t* transformed[] = {first_values.get(), second_values.get()};
+    runTasks(2, parallel_size, [&](size_t factor) {
+      const LimbStorage& limbs = factors[factor]->data_;
+      uint32_t* values = transformed[factor];
+      runBlocks(size, parallel_size, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index) {
+          values[index] = index < limbs.size() ? limbs[index] % modulo : 0;
+        }
+      });
+      transformNumberTheoretic<modulo>(values, size, false, parallel_size);
+    });
+    runBlocks(size, parallel_size, [&](size_t begin, size_t end) {
+      for (size_t index = begin; index < end; ++index) {
+        first_values[index] = static_cast<uint32_t>(
+            static_cast<uint64_t>(first_values[index]) * second_values[index] %
+            modulo);
+      }
+    });
+    transformNumberTheoretic<modulo>(first_values.get(), size, true,
+                                     parallel_size);
+    return first_values;
+  }
+
+  // Every pass (bit reversal, root tables, each butterfly stage and the
+  // final scaling) is split into blocks of independent items, so a product
+  // of parallel_size limbs spreads each of them over the worker pool.
+  template <uint32_t modulo>
+  static void transformNumberTheoretic(uint32_t* values, size_t size,
+                                       bool is_inverse, size_t parallel_size) {
+    runBlocks(size, parallel_size, [&](size_t begin, size_t end) {
+      size_t reversed = 0;
+      for (size_t bit = 1, mirrored = size >> 1; bit < size;
+           bit <<= 1, mirrored >>= 1) {
+        if ((begin & bit) != 0) {
+          reversed |= mirrored;
+        }
+      }
+      for (size_t index = begin; index < end; ++index) {
+        if (index < reversed) {
+          std::swap(values[index], values[reversed]);
+        }
+        size_t bit = size >> 1;
+        for (; (reversed & bit) != 0; bit >>= 1) {
+          reversed ^= bit;
+        }
+        reversed ^= bit;
+      }
+    });
+    std::unique_ptr<uint32_t[]> roots(new uint32_t[size / 2]);
+    std::unique_ptr<uint32_t[]> root_quotients(new uint32_t[size / 2]);
+    for (size_t length = 2; length <= size; length <<= 1) {
+      size_t half = length / 2;
+      uint64_t root = powerModulo<modulo>(kPrimitiveRoot, (modulo - 1) / length);
+      if (is_inverse) {
+        root = powerModulo<modulo>(root, modulo - 2);
+      }
+      // Shoup's trick: with quotient = roots * 2^32 / modulo precomputed,
+      // a product modulo the prime needs no division.
+      runBlocks(half, parallel_size, [&](size_t begin, size_t end) {
+        uint64_t power = powerModulo<modulo>(root, begin);
+        for (size_t index = begin; index < end; ++index) {
+          roots[index] = static_cast<uint32_t>(power);
+          root_quotients[index] =
+              static_cast<uint32_t>((power << kLimbBits) / modulo);
+          power = power * root % modulo;
+        }
+      });
+      // Butterfly number k pairs item k % half of block k / half.
+      runBlocks(size / 2, parallel_size, [&](size_t begin, size_t end) {
+        size_t first = begin % half;
+        uint32_t* even_values = values + begin / half * length;
+        for (size_t butterfly = begin; butterfly < end;
+             butterfly += half - first, first = 0, even_values += length) {
+          uint32_t* odd_values = even_values + half;
+          size_t last = std::min(half, first + (end - butterfly));
+          for (size_t index = first; index < last; ++index) {
+            uint32_t even = even_values[index];
+            uint32_t quotient = static_cast<uint32_t>(
+                (static_cast<uint64_t>(odd_values[index]) *
+                 root_quotients[index]) >>
+                kLimbBits);
+            uint32_t odd =
+                odd_values[index] * roots[index] - quotient * modulo;
+            if (odd >= modulo) {
+              odd -= modulo;
+            }
+            even_values[index] =
+                even + odd >= modulo ? even + odd - modulo : even + odd;
+            odd_values[index] = even >= odd ? even - odd : even + modulo - odd;
+          }
+        }
+      });
+    }
+    if (is_inverse) {
+      uint64_t size_inverse = powerModulo<modulo>(size, modulo - 2);
+      runBlocks(size, parallel_size, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index) {
+          values[index] =
+              static_cast<uint32_t>(values[index] * size_inverse % modulo);
+        }
+      });
+    }
+  }
+
+  template <uint32_t modulo>
+  static uint64_t powerModulo(uint64_t number, uint64_t power) {
+    uint64_t result = 1;
+    number %= modulo;
+    while (power > 0) {
+      if (power % 2 == 1) {
+        result = result * number % modulo;
+      }
+      number = number * number % modulo;
+      power /= 2;
+    }
+    return result;
+  }
+
+  // Leaves |*this| % |number| in place and returns |*this| / |number|.
+  BigInteger divideWithRemainder(const BigInteger& number) {
+    if (number.data_.size() < division_threshold_ ||
+        data_.size() < number.data_.size() + division_threshold_) {
+      return divideSchoolbook(number);
+    }
+    BigInteger dividend = *this;
+    BigInteger divider = number;
+    dividend.is_positive_ = true;
+    divider.is_positive_ = true;
+    BigInteger remainder;
+    BigInteger result = divideRecursive(dividend, divider, remainder);
+    data_ = std::move(remainder.data_);
+    return result;
+  }
+
+  BigInteger divideSchoolbook(const BigInteger& number) {
+    BigInteger result;
+    if (isSmallerWithoutSign(number)) {
+      return result;
+    }
+    if (number.data_.size() == 1) {
+      result.data_ = data_;
+      data_.assign(1, result.divideBySmall(number.data_[0]));
+      return result;
+    }
+    size_t shift = countLeadingZeros(number.data_.back());
+    LimbStorage divider = shiftLimbsLeft(number.data_, shift);
+    LimbStorage remainder = shiftLimbsLeft(data_, shift);
+    remainder.push_back(0);
+    size_t divider_size = divider.size();
+    result.data_.assign(remainder.size() - divider_size, 0);
+    for (size_t index = result.data_.size(); index > 0; --index) {
+      result.data_[index - 1] = divideStep(
+          remainder.data() + index - 1, divider.data(), divider_size);
+    }
+    remainder.resize(divider_size);
+    data_ = shiftLimbsRight(remainder, shift);
+    deleteZeros();
+    result.deleteZeros();
+    return result;
+  }
+
+  // Burnikel-Ziegler division: the dividend is split into blocks as long as
+  // the divider, and each block is divided by divideTwoByOne. All arguments
+  // are non-negative.
+  static BigInteger divideRecursive(const BigInteger& dividend,
+                                    const BigInteger& divider,
+                                    BigInteger& remainder) {
+    size_t bits = divider.bitLength();
+    size_t blocks = (dividend.bitLength() + bits - 1) / bits;
+    BigInteger result;
+    remainder = 0;
+    for (size_t block = blocks; block > 0; --block) {
+      remainder.shiftBitsLeft(bits);
+      remainder.plusWithShift(dividend.bitsSlice((block - 1) * bits, bits), 0);
+      result.shiftBitsLeft(bits);
+      result.plusWithShift(divideTwoByOne(remainder, divider, bits, remainder),
+                           0);
+    }
+    return result;
+  }
+
+  // Divides dividend < divider * 2^bits by a divider of exactly bits bits.
+  static BigInteger divideTwoByOne(BigInteger dividend, BigInteger divider,
+                                   size_t bits, BigInteger& remainder) {
+    if (bits < division_threshold_ * kLimbBits) {
+      BigInteger result = dividend.divideSchoolbook(divider);
+      remainder = std::move(dividend);
+      return result;
+    }
+    bool is_padded = bits % 2 == 1;
+    if (is_padded) {
+      dividend.shiftBitsLeft(1);
+      divider.shiftBitsLeft(1);
+      ++bits;
+    }
+    size_t half = bits / 2;
+    BigInteger divider_high = divider;
+    divider_high.shiftBitsRight(half);
+    BigInteger divider_low = divider.bitsSlice(0, half);
+    BigInteger dividend_high = dividend;
+    dividend_high.shiftBitsRight(bits);
+    BigInteger result =
+        divideThreeByTwo(dividend_high, dividend.bitsSlice(half, half),
+                         divider, divider_high, divider_low, half, remainder);
+    BigInteger result_low =
+        divideThreeByTwo(remainder, dividend.bitsSlice(0, half), divider,
+                         divider_high, divider_low, half, remainder);
+    if (is_padded) {
+      remainder.shiftBitsRight(1);
+    }
+    result.shiftBitsLeft(half);
+    result.plusWithShift(result_low, 0);
+    return result;
+  }
+
+  static BigInteger divideThreeByTwo(const BigInteger& dividend_high,
+                                     const BigInteger& dividend_low,
+                                     const BigInteger& divider,
+                                     const BigInteger& divider_high,
+                                     const BigInteger& divider_low,
+                                     size_t bits, BigInteger& remainder) {
+    BigInteger result;
+    BigInteger top = dividend_high;
+    top.shiftBitsRight(bits);
+    if (top == divider_high) {
+      result = 1;
+      result.shiftBitsLeft(bits);
+      --result;
+      remainder = dividend_high + divider_high;
+      top.shiftBitsLeft(bits);
+      remainder -= top;
+    } else {
+      result = divideTwoByOne(dividend_high, divider_high, bits, remainder);
+    }
+    remainder.shiftBitsLeft(bits);
+    remainder += dividend_low;
+    remainder -= result * divider_low;
+    while (!remainder.is_positive_) {
+      --result;
+      remainder += divider;
+    }
+    return result;
+  }
+
+  void shiftBitsLeft(size_t bits) {
+    if (isZero()) {
+      return;
+    }
+    size_t limbs = bits / kLimbBits;
+    size_t shift = bits % kLimbBits;
+    size_t size = data_.size();
+    data_.resize(size + limbs + 1, 0);
+    uint32_t* values = data_.data();
+    if (shift == 0) {
+      std::copy_backward(values, values + size, values + size + limbs);
+    } else {
+      values[size + limbs] = values[size - 1] >> (kLimbBits - shift);
+      for (size_t index = size - 1; index > 0; --index) {
+        values[index + limbs] = (values[index] << shift) |
+                                (values[index - 1] >> (kLimbBits - shift));
+      }
+      values[limbs] = values[0] << shift;
+    }
+    std::fill(values, values + limbs, 0);
+    deleteZeros();
+  }
+
+  void shiftBitsRight(size_t bits) {
+    size_t limbs = bits / kLimbBits;
+    if (limbs >= data_.size()) {
+      data_.assign(1, 0);
+      correctMinusZero();
+      return;
+    }
+    size_t shift = bits % kLimbBits;
+    size_t size = data_.size() - limbs;
+    uint32_t* values = data_.data();
+    if (shift == 0) {
+      std::copy(values + limbs, values + limbs + size, values);
+    } else {
+      for (size_t index = 0; index + 1 < size; ++index) {
+        values[index] = (values[index + limbs] >> shift) |
+                        (values[index + limbs + 1] << (kLimbBits - shift));
+      }
+      values[size - 1] = values[size - 1 + limbs] >> shift;
+    }
+    data_.resize(size);
+    deleteZeros();
+    correctMinusZero();
+  }
+
+  // Returns the non-negative number formed by count bits of |*this| starting
+  // at bit begin.
+  BigInteger bitsSlice(size_t begin, size_t count) const {
+    BigInteger result =
+        limbsSlice(begin / kLimbBits, (begin % kLimbBits + count) / kLimbBits + 1);
+    result.shiftBitsRight(begin % kLimbBits);
+    size_t limbs = (count + kLimbBits - 1) / kLimbBits;
+    if (result.data_.size() >= limbs) {
+      result.data_.resize(limbs);
+      if (count % kLimbBits != 0) {
+        result.data_.back() &=
+            (static_cast<uint32_t>(1) << (count % kLimbBits)) - 1;
+      }
+      result.deleteZeros();
+    }
+    return result;
+  }
+
+  uint32_t remainderBySmall(uint32_t divider) const {
+    uint64_t buffer = 0;
+    for (size_t index = data_.size(); index > 0; --index) {
+      buffer = ((buffer << kLimbBits) | data_[index - 1]) % divider;
+    }
+    return static_cast<uint32_t>(buffer);
+  }
+
+  // base^exponent mod modulo for base < modulo < 2^32.
+  static uint64_t powModWord(uint64_t base, size_t exponent, uint64_t modulo) {
+    uint64_t result = 1 % modulo;
+    for (; exponent > 0; exponent /= 2) {
+      if (exponent % 2 == 1) {
+        result = result * base % modulo;
+      }
+      base = base * base % modulo;
+    }
+    return result;
+  }
+
+  // Trial division by a few small primes, then Miller-Rabin with bases 2, 7
+  // and 61, which is exact for number < 2^32.
+  static bool isPrimeWord(uint64_t number) {
+    const uint64_t kSmallPrimes[] = {2,  3,  5,  7,  11, 13,
+                                     17, 19, 23, 29, 31, 61};
+    const uint64_t kBases[] = {2, 7, 61};
+    if (number < 2) {
+      return false;
+    }
+    for (uint64_t prime : kSmallPrimes) {
+      if (number % prime == 0) {
+        return number == prime;
+      }
+    }
+    uint64_t odd_part = number - 1;
+    size_t shift = 0;
+    for (; odd_part % 2 == 0; odd_part /= 2) {
+      ++shift;
+    }
+    for (uint64_t base : kBases) {
+      uint64_t power = powModWord(base % number, odd_part, number);
+      bool is_witness = power != 1 && power != number - 1;
+      for (size_t step = 1; step < shift && is_witness; ++step) {
+        power = power * power % number;
+        is_witness = power != number - 1;
+      }
+      if (is_witness) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static uint64_t gcdWord(uint64_t first, uint64_t second) {
+    while (second != 0) {
+      first %= second;
+      std::swap(first, second);
+    }
+    return first;
+  }
+
+  // Replaces (first, second) with (a * first + b * second,
+  // c * first + d * second) for |a|, |b|, |c|, |d| < 2^62 in one pass over
+  // the limbs, without temporaries. The signs of first and second are moved
+  // into the factors, the sums are built in two's complement with signed
+  // carries, and a negative result is negated back at the end.
+  static void combineLinear(BigInteger& first, BigInteger& second, int64_t a,
+                            int64_t b, int64_t c, int64_t d) {
+    if (!first.is_positive_) {
+      a = -a;
+      c = -c;
+    }
+    if (!second.is_positive_) {
+      b = -b;
+      d = -d;
+    }
+    size_t size = std::max(first.data_.size(), second.data_.size()) + 2;
+    first.data_.resize(size);
+    second.data_.resize(size);
+    __int128 first_carry = 0;
+    __int128 second_carry = 0;
+    for (size_t index = 0; index < size; ++index) {
+      uint32_t first_limb = first.data_[index];
+      uint32_t second_limb = second.data_[index];
+      first_carry += static_cast<__int128>(a) * first_limb +
+                     static_cast<__int128>(b) * second_limb;
+      second_carry += static_cast<__int128>(c) * first_limb +
+                      static_cast<__int128>(d) * second_limb;
+      first.data_[index] = static_cast<uint32_t>(first_carry);
+      second.data_[index] = static_cast<uint32_t>(second_carry);
+      first_carry >>= kLimbBits;
+      second_carry >>= kLimbBits;
+    }
+    first.setFromTwosComplement(first_carry < 0);
+    second.setFromTwosComplement(second_carry < 0);
+  }
+
+  // Turns limbs holding a two's complement value with the given sign into
+  // sign and magnitude.
+  void setFromTwosComplement(bool is_negative) {
+    if (is_negative) {
+      uint64_t carry = 1;
+      for (uint32_t& limb : data_) {
+        carry += static_cast<uint32_t>(~limb);
+        limb = static_cast<uint32_t>(carry);
+        carry >>= kLimbBits;
+      }
+    }
+    is_positive_ = !is_negative;
+    deleteZeros();
+    correctMinusZero();
+  }
+
+  // Lehmer's algorithm for non-negative first and second: the quotients of
+  // several Euclid steps are guessed from the leading 62 bits and applied
+  // at once. If first_factor is given, it receives x with
+  // first * x = gcd (mod second).
+  static BigInteger gcdLehmer(BigInteger first, BigInteger second,
+                              BigInteger* first_factor) {
+    BigInteger factor = 1;
+    BigInteger second_factor = 0;
+    if (first < second) {
+      std::swap(first, second);
+      std::swap(factor, second_factor);
+    }
+    while (!second.isZero()) {
+      if (first.isWord() && first_factor == nullptr) {
+        first.setMagnitude(gcdWord(first.toWord(), second.toWord()));
+        break;
+      }
+      size_t bits = first.bitLength();
+      size_t shift = bits > kLehmerBits ? bits - kLehmerBits : 0;
+      int64_t first_lead =
+          static_cast<int64_t>(first.bitsSlice(shift, kLehmerBits).toWord());
+      int64_t second_lead =
+          static_cast<int64_t>(second.bitsSlice(shift, kLehmerBits).toWord());
+      int64_t a = 1, b = 0, c = 0, d = 1;
+      while (second_lead + c != 0 && second_lead + d != 0) {
+        int64_t quotient = (first_lead + a) / (second_lead + c);
+        if (quotient != (first_lead + b) / (second_lead + d)) {
+          break;
+        }
+        int64_t next = a - quotient * c;
+        a = c;
+        c = next;
+        next = b - quotient * d;
+        b = d;
+        d = next;
+        next = first_lead - quotient * second_lead;
+        first_lead = second_lead;
+        second_lead = next;
+      }
+      if (b == 0) {
+        BigInteger quotient = first.divMod(second);
+        std::swap(first, second);
+        if (first_factor != nullptr) {
+          factor.subMul(quotient, second_factor);
+          std::swap(factor, second_factor);
+        }
+      } else {
+        combineLinear(first, second, a, b, c, d);
+        if (first_factor != nullptr) {
+          combineLinear(factor, second_factor, a, b, c, d);
+        }
+      }
+    }
+    if (first_factor != nullptr) {
+      *first_factor = std::move(factor);
+    }
+    return first;
+  }
+
+  // One step of Knuth's algorithm D: divides the (size + 1)-limb prefix of
+  // remainder by the normalized divider and replaces it with the remainder.
+  static uint32_t divideStep(uint32_t* remainder, const uint32_t* divider,
+                             size_t size) {
+    uint64_t numerator =
+        (static_cast<uint64_t>(remainder[size]) << kLimbBits) |
+        remainder[size - 1];
+    uint64_t quotient = numerator / divider[size - 1];
+    uint64_t rest = numerator % divider[size - 1];
+    while (quotient >= kBase ||
+           quotient * divider[size - 2] >
+               ((rest << kLimbBits) | remainder[size - 2])) {
+      --quotient;
+      rest += divider[size - 1];
+      if (rest >= kBase) {
+        break;
+      }
+    }
+    uint64_t carry = 0;
+    uint64_t buffer = 0;
+    for (size_t index = 0; index < size; ++index) {
+      uint64_t product = quotient * divider[index] + carry;
+      carry = product >> kLimbBits;
+      buffer = static_cast<uint64_t>(remainder[index]) -
+               static_cast<uint32_t>(product) - buffer;
+      remainder[index] = static_cast<uint32_t>(buffer);
+      buffer >>= kBorrowShift;
+    }
+    buffer = static_cast<uint64_t>(remainder[size]) - carry - buffer;
+    remainder[size] = static_cast<uint32_t>(buffer);
+    if ((buffer >> kBorrowShift) == 0) {
+      return static_cast<uint32_t>(quotient);
+    }
+    buffer = 0;
+    for (size_t index = 0; index < size; ++index) {
+      buffer += static_cast<uint64_t>(remainder[index]) + divider[index];
+      remainder[index] = static_cast<uint32_t>(buffer);
+      buffer >>= kLimbBits;
+    }
+    remainder[size] += static_cast<uint32_t>(buffer);
+    return static_cast<uint32_t>(quotient - 1);
+  }
+
+  static size_t countLeadingZeros(uint32_t limb) {
+    size_t result = 0;
+    while ((limb & (static_cast<uint32_t>(1) << (kLimbBits - 1))) == 0) {
+      limb <<= 1;
+      ++result;
+    }
+    return result;
+  }
+
+  static LimbStorage shiftLimbsLeft(const LimbStorage& limbs, size_t shift) {
+    if (shift == 0) {
+      return limbs;
+    }
+    LimbStorage result(limbs.size(), 0);
+    uint32_t carry = 0;
+    for (size_t index = 0; index < limbs.size(); ++index) {
+      result[index] = (limbs[index] << shift) | carry;
+      carry = limbs[index] >> (kLimbBits - shift);
+    }
+    if (carry != 0) {
+      result.push_back(carry);
+    }
+    return result;
+  }
+
+  static LimbStorage shiftLimbsRight(const LimbStorage& limbs, size_t shift) {
+    if (shift == 0) {
+      return limbs;
+    }
+    LimbStorage result(limbs.size(), 0);
+    for (size_t index = 0; index < limbs.size(); ++index) {
+      result[index] = limbs[index] >> shift;
+      if (index + 1 < limbs.size()) {
+        result[index] |= limbs[index + 1] << (kLimbBits - shift);
+      }
+    }
+    return result;
+  }
+
+  void correctMinusZero() {
+    if (isZero()) {
+      is_positive_ = true;
+    }
+  }
+
+  LimbStorage data_ = LimbStorage(1, 0);
+  bool is_positive_ = true;
+  static const size_t kLimbBits = 32;
+  static const uint64_t kBase = static_cast<uint64_t>(1) << 32;
+  static const size_t kBorrowShift = 63;
+  static const uint32_t kDecimalBase = 1000000000;
+  static const size_t kDecimalBaseDigits = 9;
+  static const size_t kLehmerBits = 62;
+  static const size_t kSmallScaleDigits = 36;
+  static const size_t kRadixConversionThreshold = 32;
+  static const size_t kReciprocalThreshold = 256;
+  static const size_t kReciprocalExactBits = 4096;
+  static const size_t kReciprocalGuardBits = 16;
+  static const size_t kToomCookPoints = 5;
+  static const size_t kMinThreshold = 4;
+  static const size_t kBlocksPerThread = 4;
+  static const size_t kMinBlockItems = 4096;
+  static const size_t kMaxTransformSize = static_cast<size_t>(1) << 23;
+  static const uint32_t kFirstModulo = 998244353;
+  static const uint32_t kSecondModulo = 469762049;
+  static const uint32_t kThirdModulo = 167772161;
+  static const uint32_t kPrimitiveRoot = 3;
+  // The multiplication settings are read by pool workers as well.
+  static inline std::atomic<size_t> karatsuba_threshold_ = 32;
+  static inline std::atomic<size_t> toom_cook_threshold_ = 160;
+  static inline std::atomic<size_t> number_theoretic_threshold_ = 6144;
+  static inline size_t division_threshold_ = 160;
+  static inline std::atomic<size_t> thread_limit_ = 1;
+  static inline std::atomic<size_t> parallel_threshold_ = 2048;
+};
+
 bool operator<(const BigInteger& first, const BigInteger& second) {
   if (first.isPositive() != second.isPositive()) {
     return !first.isPositive();
@@ -397,10 +1996,7 @@ bool operator<(const BigInteger& first, const BigInteger& second) {
   if (first.isPositive()) {
     return first.isSmallerWithoutSign(second);
   }
-  if (!first.isPositive()) {
-    return !first.isSmallerWithoutSign(second);
-  }
-  return false;
+  return second.isSmallerWithoutSign(first);
 }
 
 bool operator>(const BigInteger& first, const BigInteger& second) {
@@ -416,112 +2012,723 @@ bool operator>=(const BigInteger& first, const BigInteger& second) {
 }
 
 bool operator==(const BigInteger& first, const BigInteger& second) {
-  return !((first < second) || (second < first));
+  return first.isPositive() == second.isPositive() &&
+         first.compareWithoutSign(second) == 0;
 }
 
 bool operator!=(const BigInteger& first, const BigInteger& second) {
-  return (first < second) || (second < first);
+  return !(first == second);
+}
+
+BigInteger operator+(BigInteger first, const BigInteger& second) {
+  first += second;
+  return first;
+}
+
+BigInteger operator+(const BigInteger& first, BigInteger&& second) {
+  second += first;
+  return std::move(second);
+}
+
+BigInteger operator-(BigInteger first, const BigInteger& second) {
+  first -= second;
+  return first;
+}
+
+BigInteger operator-(const BigInteger& first, BigInteger&& second) {
+  second -= first;
+  second.changeSgn();
+  return std::move(second);
+}
+
+BigInteger operator*(BigInteger first, const BigInteger& second) {
+  first *= second;
+  return first;
+}
+
+BigInteger operator*(const BigInteger& first, BigInteger&& second) {
+  second *= first;
+  return std::move(second);
+}
+
+BigInteger operator/(BigInteger first, const BigInteger& second) {
+  first /= second;
+  return first;
+}
+
+BigInteger operator%(BigInteger first, const BigInteger& second) {
+  first %= second;
+  return first;
+}
+
+BigInteger operator<<(BigInteger number, size_t bits) {
+  number <<= bits;
+  return number;
+}
+
+BigInteger operator>>(BigInteger number, size_t bits) {
+  number >>= bits;
+  return number;
+}
+
+// Digits are written straight to the stream unless a field width is set;
+// then formatted output applies the fill and adjustment and resets width().
+std::ostream& operator<<(std::ostream& out, const BigInteger& bigint) {
+  if (out.width() != 0) {
+    return out << bigint.toString();
+  }
+  bigint.writeDecimal(out);
+  return out;
+}
+
+std::istream& operator>>(std::istream& in, BigInteger& bigint) {
+  std::string str;
+  in >> str;
+  bigint.setByString(str);
+  return in;
+}
+
+BigInteger Gcd(const BigInteger& first, const BigInteger& second) {
+  BigInteger first_abs = first;
+  BigInteger second_abs = second;
+  first_abs.is_positive_ = true;
+  second_abs.is_positive_ = true;
+  return BigInteger::gcdLehmer(std::move(first_abs), std::move(second_abs),
+                               nullptr);
+}
+
+// Returns gcd(first, second) and sets the coefficients so that
+// first * first_coefficient + second * second_coefficient = gcd.
+BigInteger ExtendedGcd(const BigInteger& first, const BigInteger& second,
+                       BigInteger& first_coefficient,
+                       BigInteger& second_coefficient) {
+  BigInteger first_abs = first;
+  BigInteger second_abs = second;
+  first_abs.is_positive_ = true;
+  second_abs.is_positive_ = true;
+  BigInteger factor;
+  BigInteger gcd = BigInteger::gcdLehmer(first_abs, second_abs, &factor);
+  if (second_abs.isZero()) {
+    first_coefficient = first.isPositive() ? 1 : -1;
+    second_coefficient = 0;
+    return gcd;
+  }
+  factor %= second_abs / gcd;
+  if (!first.isPositive()) {
+    factor.changeSgn();
+  }
+  second_coefficient = (gcd - first * factor) / second;
+  first_coefficient = std::move(factor);
+  return gcd;
+}
+
+BigInteger Pow(BigInteger base, size_t exponent) {
+  BigInteger result = 1;
+  while (exponent > 0) {
+    if (exponent % 2 == 1) {
+      result *= base;
+    }
+    exponent /= 2;
+    if (exponent > 0) {
+      base *= base;
+    }
+  }
+  return result;
+}
+
+// Precomputed data for Montgomery multiplication modulo a fixed odd number.
+// Numbers in Montgomery form are stored as x * R mod modulo, R = 2^(32n).
+class MontgomeryContext {
+ public:
+  explicit MontgomeryContext(const BigInteger& modulo)
+      : modulo_(modulo),
+        size_(modulo.data_.size()),
+        is_interleaved_(size_ < kInterleavedThreshold) {
+    uint32_t inverse = modulo_.data_[0];
+    for (int step = 0; step < 5; ++step) {
+      inverse *= 2 - modulo_.data_[0] * inverse;
+    }
+    limb_inverse_ = -inverse;
+    BigInteger radix = 1;
+    radix.shiftBitsLeft(size_ * BigInteger::kLimbBits);
+    if (!is_interleaved_) {
+      BigInteger coefficient;
+      ExtendedGcd(modulo_, radix, inverse_, coefficient);
+      inverse_.changeSgn();
+      inverse_ %= radix;
+      if (!inverse_.isPositive()) {
+        inverse_ += radix;
+      }
+    }
+    radix_square_ = radix * radix % modulo_;
+  }
+
+  const BigInteger& modulo() const { return modulo_; }
+
+  BigInteger toMontgomery(BigInteger number) const {
+    number %= modulo_;
+    if (!number.isPositive()) {
+      number += modulo_;
+    }
+    return multiply(number, radix_square_);
+  }
+
+  BigInteger fromMontgomery(const BigInteger& number) const {
+    return multiply(number, 1);
+  }
+
+  // Returns first * second / R mod modulo for first, second < modulo.
+  BigInteger multiply(const BigInteger& first, const BigInteger& second) const {
+    BigInteger result;
+    if (is_interleaved_) {
+      multiplyInterleaved(first, second, result);
+    } else {
+      BigInteger product = first * second;
+      BigInteger quotient =
+          (product.limbsSlice(0, size_) * inverse_).limbsSlice(0, size_);
+      result = std::move(product);
+      result.addMul(quotient, modulo_);
+      result.data_.erase(result.data_.begin(),
+                         result.data_.begin() +
+                             std::min(size_, result.data_.size() - 1));
+      result.deleteZeros();
+    }
+    if (!result.isSmallerWithoutSign(modulo_)) {
+      result -= modulo_;
+    }
+    return result;
+  }
+
+  // Returns base^exponent mod modulo for a non-negative exponent, scanning
+  // the exponent with a sliding window of odd powers.
+  BigInteger power(const BigInteger& base, const BigInteger& exponent) const {
+    size_t bits = exponent.bitLength();
+    size_t window = 1;
+    while (window < kMaxWindow && bits > kWindowBits[window]) {
+      ++window;
+    }
+    BigInteger unit = toMontgomery(1);
+    if (bits == 0) {
+      return fromMontgomery(unit);
+    }
+    std::vector<BigInteger> odd_powers(1, toMontgomery(base));
+    BigInteger square = multiply(odd_powers[0], odd_powers[0]);
+    for (size_t index = 1; index < (static_cast<size_t>(1) << (window - 1));
+         ++index) {
+      odd_powers.push_back(multiply(odd_powers.back(), square));
+    }
+    BigInteger result = unit;
+    size_t position = bits;
+    while (position > 0) {
+      if (!exponent.testBit(position - 1)) {
+        result = multiply(result, result);
+        --position;
+        continue;
+      }
+      size_t low = position > window ? position - window : 0;
+      while (!exponent.testBit(low)) {
+        ++low;
+      }
+      size_t value = 0;
+      for (size_t index = position; index > low; --index) {
+        result = multiply(result, result);
+        value = value * 2 + (exponent.testBit(index - 1) ? 1 : 0);
+      }
+      result = multiply(result, odd_powers[value / 2]);
+      position = low;
+    }
+    return fromMontgomery(result);
+  }
+
+ private:
+  // Montgomery product with the reduction interleaved into the limb loop.
+  void multiplyInterleaved(const BigInteger& first, const BigInteger& second,
+                           BigInteger& result) const {
+    const uint32_t* modulo = modulo_.data_.data();
+    LimbStorage padded = second.data_;
+    padded.resize(size_);
+    const uint32_t* multiplier = padded.data();
+    LimbStorage buffer(size_ + 1, 0);
+    uint32_t* values = buffer.data();
+    for (size_t index = 0; index < size_; ++index) {
+      uint64_t limb = index < first.data_.size() ? first.data_[index] : 0;
+      uint64_t product = values[0] + limb * multiplier[0];
+      uint64_t factor = static_cast<uint32_t>(product) * limb_inverse_;
+      uint64_t reduced =
+          static_cast<uint32_t>(product) + factor * modulo[0];
+      for (size_t inner = 1; inner < size_; ++inner) {
+        product = values[inner] + limb * multiplier[inner] +
+                  (product >> BigInteger::kLimbBits);
+        reduced = static_cast<uint32_t>(product) + factor * modulo[inner] +
+                  (reduced >> BigInteger::kLimbBits);
+        values[inner - 1] = static_cast<uint32_t>(reduced);
+      }
+      product = values[size_] + (product >> BigInteger::kLimbBits);
+      reduced = static_cast<uint32_t>(product) +
+                (reduced >> BigInteger::kLimbBits);
+      values[size_ - 1] = static_cast<uint32_t>(reduced);
+      values[size_] = static_cast<uint32_t>((product >> BigInteger::kLimbBits) +
+                                            (reduced >> BigInteger::kLimbBits));
+    }
+    result.data_ = std::move(buffer);
+    result.deleteZeros();
+  }
+
+  static const size_t kInterleavedThreshold = 512;
+  static const size_t kMaxWindow = 6;
+  static constexpr size_t kWindowBits[kMaxWindow] = {0, 24, 80, 240, 672, 1792};
+
+  BigInteger modulo_;
+  size_t size_;
+  bool is_interleaved_;
+  uint32_t limb_inverse_;
+  BigInteger inverse_;
+  BigInteger radix_square_;
+};
+
+// Returns base^exponent mod modulo in [0, modulo) for a positive modulo and a
+// non-negative exponent.
+BigInteger PowMod(const BigInteger& base, const BigInteger& exponent,
+                  const MontgomeryContext& context) {
+  return context.power(base, exponent);
+}
+
+BigInteger PowMod(BigInteger base, const BigInteger& exponent,
+                  const BigInteger& modulo) {
+  if (modulo.testBit(0)) {
+    return MontgomeryContext(modulo).power(base, exponent);
+  }
+  base %= modulo;
+  if (!base.isPositive()) {
+    base += modulo;
+  }
+  BigInteger result = 1;
+  for (size_t index = exponent.bitLength(); index > 0; --index) {
+    result = result * result % modulo;
+    if (exponent.testBit(index - 1)) {
+      result = result * base % modulo;
+    }
+  }
+  return result % modulo;
+}
+
+// Returns floor(|number|^(1 / degree)) with the sign of number. Throws
+// std::domain_error for a zero degree and for an even root of a negative
+// number. Newton's iteration runs from above, seeded by a floating-point
+// estimate for short roots and otherwise by the root of the top bits, so each
+// level of recursion costs about one division.
+BigInteger Iroot(const BigInteger& number, size_t degree) {
+  if (degree == 0) {
+    throw std::domain_error("zero root degree");
+  }
+  if (!number.isPositive()) {
+    if (degree % 2 == 0) {
+      throw std::domain_error("even root of a negative number");
+    }
+    return -Iroot(-number, degree);
+  }
+  const size_t kDirectRootBits = 60;
+  const size_t kMantissaBits = 53;
+  const double kEstimateSlack = 1e-9;
+  size_t bits = number.bitLength();
+  if (degree == 1 || bits <= 1) {
+    return number;
+  }
+  size_t root_bits = (bits + degree - 1) / degree;
+  BigInteger estimate;
+  if (root_bits <= kDirectRootBits) {
+    size_t top_bits = std::min(bits, kMantissaBits);
+    double top = 0;
+    for (size_t index = 1; index <= top_bits; ++index) {
+      top = 2 * top + (number.testBit(bits - index) ? 1 : 0);
+    }
+    double logarithm = std::log2(top) + static_cast<double>(bits - top_bits);
+    estimate = static_cast<uint64_t>(
+        std::exp2(logarithm / static_cast<double>(degree)) *
+            (1 + kEstimateSlack) +
+        2);
+  } else {
+    size_t shift = root_bits / 2;
+    estimate = Iroot(number >> (shift * degree), degree) + 1;
+    estimate <<= shift;
+  }
+  while (true) {
+    BigInteger next = number / Pow(estimate, degree - 1);
+    next.addMul(estimate, degree - 1);
+    next /= degree;
+    if (!(next < estimate)) {
+      return estimate;
+    }
+    estimate = std::move(next);
+  }
 }
 
-BigInteger operator+(const BigInteger& first, const BigInteger& second) {
-  BigInteger result = first;
-  result += second;
-  return result;
-}
+BigInteger Isqrt(const BigInteger& number) { return Iroot(number, 2); }
 
-BigInteger operator-(const BigInteger& first, const BigInteger& second) {
-  BigInteger result = first;
-  result -= second;
+// Reduces number >= 0 modulo every word in moduli with a remainder tree:
+// number is divided once by the product of all moduli, and each remainder
+// is then reduced by the two halves of its product down to the leaves.
+std::vector<uint32_t> RemaindersByTree(const BigInteger& number,
+                                       const std::vector<uint32_t>& moduli) {
+  if (moduli.empty()) {
+    return {};
+  }
+  std::vector<std::vector<BigInteger>> levels(1);
+  levels[0].assign(moduli.begin(), moduli.end());
+  while (levels.back().size() > 1) {
+    const std::vector<BigInteger>& lower = levels.back();
+    std::vector<BigInteger> upper;
+    upper.reserve((lower.size() + 1) / 2);
+    for (size_t index = 0; index < lower.size(); index += 2) {
+      upper.push_back(index + 1 < lower.size() ? lower[index] * lower[index + 1]
+                                               : lower[index]);
+    }
+    levels.push_back(std::move(upper));
+  }
+  std::vector<BigInteger> remainders(1, number % levels.back()[0]);
+  for (size_t level = levels.size() - 1; level > 0; --level) {
+    const std::vector<BigInteger>& lower = levels[level - 1];
+    std::vector<BigInteger> lower_remainders;
+    lower_remainders.reserve(lower.size());
+    for (size_t index = 0; index < lower.size(); ++index) {
+      lower_remainders.push_back(remainders[index / 2] % lower[index]);
+    }
+    remainders = std::move(lower_remainders);
+  }
+  std::vector<uint32_t> result(moduli.size());
+  for (size_t index = 0; index < moduli.size(); ++index) {
+    result[index] = static_cast<uint32_t>(remainders[index].toWord());
+  }
   return result;
 }
 
-BigInteger operator*(const BigInteger& first, const BigInteger& second) {
-  BigInteger result = first;
-  result *= second;
-  return result;
+// Checks whether number = root^degree for some integer root and degree > 1.
+// Only prime degrees are tried, and most are rejected before any full root:
+// - roots of at most 32 bits are pinned down by a floating-point estimate,
+//   whose few candidates are compared with number modulo two fixed primes;
+// - longer roots need number mod q to be a degree-th power residue for
+//   primes q = k * degree + 1, which a non-power fails with probability
+//   1 - 1 / degree per prime. The q of all such degrees are collected first
+//   and number is reduced modulo them by one remainder tree.
+bool IsPerfectPower(const BigInteger& number) {
+  const size_t kSmallRootBits = 32;
+  const size_t kMantissaBits = 53;
+  const size_t kResidueChecks = 4;
+  const size_t kCheckCount = 2;
+  const uint32_t kCheckModuli[kCheckCount] = {4294967291u, 4294967279u};
+  BigInteger magnitude = number.isPositive() ? number : -number;
+  size_t bits = magnitude.bitLength();
+  if (bits <= 1) {
+    return true;
+  }
+  size_t trailing_zeros = 0;
+  while (!magnitude.testBit(trailing_zeros)) {
+    ++trailing_zeros;
+  }
+  size_t top_bits = std::min(bits, kMantissaBits);
+  double logarithm =
+      std::log2(static_cast<double>(
+          magnitude.bitsSlice(bits - top_bits, top_bits).toWord())) +
+      static_cast<double>(bits - top_bits);
+  uint64_t remainders[kCheckCount];
+  for (size_t index = 0; index < kCheckCount; ++index) {
+    remainders[index] = magnitude.remainderBySmall(kCheckModuli[index]);
+  }
+  auto is_root_candidate = [&](uint64_t root, size_t degree) {
+    for (size_t index = 0; index < kCheckCount; ++index) {
+      if (BigInteger::powModWord(root % kCheckModuli[index], degree,
+                                 kCheckModuli[index]) != remainders[index]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  std::vector<size_t> residue_degrees;
+  std::vector<uint32_t> residue_moduli;
+  std::vector<size_t> moduli_ends;
+  for (size_t degree = number.isPositive() ? 2 : 3; degree <= bits; ++degree) {
+    if (!BigInteger::isPrimeWord(degree) || trailing_zeros % degree != 0) {
+      continue;
+    }
+    if ((bits + degree - 1) / degree <= kSmallRootBits) {
+      auto estimate = static_cast<uint64_t>(
+          std::exp2(logarithm / static_cast<double>(degree)));
+      for (uint64_t root = estimate > 0 ? estimate - 1 : 0;
+           root <= estimate + 2; ++root) {
+        if (is_root_candidate(root, degree) &&
+            Pow(BigInteger(root), degree) == magnitude) {
+          return true;
+        }
+      }
+      continue;
+    }
+    size_t checks = 0;
+    for (uint64_t modulo = degree + 1;
+         checks < kResidueChecks && modulo <= UINT32_MAX; modulo += degree) {
+      if (BigInteger::isPrimeWord(modulo)) {
+        residue_moduli.push_back(static_cast<uint32_t>(modulo));
+        ++checks;
+      }
+    }
+    residue_degrees.push_back(degree);
+    moduli_ends.push_back(residue_moduli.size());
+  }
+  // The smallest degree takes direct passes, so squares are confirmed before
+  // the remainder tree for the other degrees is built.
+  std::vector<uint32_t> residues;
+  auto is_power_residue = [&](size_t index) {
+    size_t degree = residue_degrees[index];
+    for (size_t modulo = index == 0 ? 0 : moduli_ends[index - 1];
+         modulo < moduli_ends[index]; ++modulo) {
+      uint64_t remainder =
+          index == 0 ? magnitude.remainderBySmall(residue_moduli[modulo])
+                     : residues[modulo];
+      if (remainder != 0 &&
+          BigInteger::powModWord(remainder,
+                                 (residue_moduli[modulo] - 1) / degree,
+                                 residue_moduli[modulo]) != 1) {
+        return false;
+      }
+    }
+    return true;
+  };
+  for (size_t index = 0; index < residue_degrees.size(); ++index) {
+    if (index == 1) {
+      residues = RemaindersByTree(magnitude, residue_moduli);
+    }
+    size_t degree = residue_degrees[index];
+    if (is_power_residue(index) &&
+        Pow(Iroot(magnitude, degree), degree) == magnitude) {
+      return true;
+    }
+  }
+  return false;
 }
 
-BigInteger operator/(const BigInteger& first, const BigInteger& second) {
-  BigInteger result = first;
-  result /= second;
-  return result;
+// Multiplies the values in [first, last) by a balanced product tree, so the
+// large multiplications get operands of similar size.
+template <typename Iterator>
+BigInteger Product(Iterator first, Iterator last) {
+  size_t count = static_cast<size_t>(std::distance(first, last));
+  if (count == 0) {
+    return 1;
+  }
+  if (count == 1) {
+    return BigInteger(*first);
+  }
+  Iterator middle = std::next(first, count / 2);
+  return Product(first, middle) * Product(middle, last);
 }
 
-BigInteger operator%(const BigInteger& first, const BigInteger& second) {
-  BigInteger result = first;
-  result %= second;
-  return result;
+std::vector<size_t> PrimesUpTo(size_t limit) {
+  std::vector<bool> is_composite(limit + 1, false);
+  std::vector<size_t> primes;
+  for (size_t number = 2; number <= limit; ++number) {
+    if (is_composite[number]) {
+      continue;
+    }
+    primes.push_back(number);
+    for (size_t multiple = number * number; multiple <= limit;
+         multiple += number) {
+      is_composite[multiple] = true;
+    }
+  }
+  return primes;
 }
 
-std::ostream& operator<<(std::ostream& out, const BigInteger& bigint) {
-  out << bigint.toString();
-  return out;
+// Multiplies the prime powers, packing as many as fit into each word before
+// the product tree. Every power is at most limit.
+BigInteger ProductOfPrimePowers(const std::vector<size_t>& primes, size_t limit,
+                                const std::vector<size_t>& exponents) {
+  std::vector<uint64_t> words(1, 1);
+  for (size_t index = 0; index < exponents.size(); ++index) {
+    for (size_t counter = 0; counter < exponents[index]; ++counter) {
+      if (words.back() > std::numeric_limits<uint64_t>::max() / limit) {
+        words.push_back(1);
+      }
+      words.back() *= primes[index];
+    }
+  }
+  return Product(words.begin(), words.end());
 }
 
-std::istream& operator>>(std::istream& in, BigInteger& bigint) {
-  std::string str;
-  in >> str;
-  bigint.setByString(str);
-  return in;
+// Luschny's prime swing: number! = ((number / 2)!)^2 * swing(number), where
+// the exponent of a prime p in swing(number) is the count of odd quotients
+// number / p^i.
+BigInteger Factorial(size_t number) {
+  std::vector<size_t> primes = PrimesUpTo(number);
+  std::vector<size_t> halves;
+  for (size_t half = number; half > 1; half /= 2) {
+    halves.push_back(half);
+  }
+  BigInteger result = 1;
+  for (size_t index = halves.size(); index > 0; --index) {
+    size_t current = halves[index - 1];
+    std::vector<size_t> exponents;
+    for (size_t prime : primes) {
+      if (prime > current) {
+        break;
+      }
+      exponents.push_back(0);
+      for (size_t quotient = current / prime; quotient > 0; quotient /= prime) {
+        exponents.back() += quotient % 2;
+      }
+    }
+    result *= result;
+    result *= ProductOfPrimePowers(primes, current, exponents);
+  }
+  return result;
 }
 
-BigInteger Gcd(BigInteger first, BigInteger second) {
-  while (second) {
-    first %= second;
-    std::swap(first, second);
+// Uses Legendre's formula for the exponent of each prime in
+// number! / (chosen! * (number - chosen)!).
+BigInteger Binomial(size_t number, size_t chosen) {
+  if (chosen > number) {
+    return 0;
   }
-  if (!first.isPositive()) {
-    first.changeSgn();
-    return first;
+  size_t rest = number - chosen;
+  std::vector<size_t> primes = PrimesUpTo(number);
+  std::vector<size_t> exponents;
+  for (size_t prime : primes) {
+    exponents.push_back(0);
+    for (size_t power = prime; power <= number; power *= prime) {
+      exponents.back() +=
+          number / power - chosen / power - rest / power;
+      if (power > number / prime) {
+        break;
+      }
+    }
   }
-  return first;
+  return ProductOfPrimePowers(primes, number, exponents);
 }
 
 class Rational {
  public:
   Rational() = default;
 
-  Rational(BigInteger big_int) : nominator_(big_int) {}
+  Rational(BigInteger big_int) : nominator_(std::move(big_int)) {}
+
+  template <typename Integer,
+            typename = std::enable_if_t<std::is_integral_v<Integer>>>
+  Rational(Integer integer) : nominator_(integer) {}
+
+  // Exact value of a finite floating-point number.
+  template <typename Floating,
+            std::enable_if_t<std::is_floating_point_v<Floating>, int> = 0>
+  explicit Rational(Floating value) {
+    const int kDigits = std::min(std::numeric_limits<Floating>::digits, 64);
+    int exponent = 0;
+    Floating fraction = std::frexp(value, &exponent);
+    nominator_ = BigInteger(std::ldexp(fraction, kDigits));
+    if (exponent >= kDigits) {
+      nominator_ <<= static_cast<size_t>(exponent - kDigits);
+    } else {
+      denominator_ <<= static_cast<size_t>(kDigits - exponent);
+      squeeze();
+    }
+  }
 
-  Rational(int integer) : nominator_(integer) {}
+  // Brings the fraction to lowest terms. The value does not change, so this
+  // is const, but it is not safe to call on one object from several threads.
+  void normalize() const {
+    if (!is_reduced_) {
+      squeeze();
+    }
+  }
 
   Rational& operator*=(const Rational& number) {
-    nominator_ *= number.nominator_;
-    denominator_ *= number.denominator_;
-    squeeze();
+    if (multiplySmall(number, false)) {
+      return *this;
+    }
+    if (is_lazy_) {
+      nominator_ *= number.nominator_;
+      denominator_ *= number.denominator_;
+      reduce();
+      return *this;
+    }
+    if (this == &number) {
+      normalize();
+      nominator_ *= nominator_;
+      denominator_ *= denominator_;
+      return *this;
+    }
+    normalize();
+    number.normalize();
+    multiplyReduced(number.nominator_, number.denominator_);
     return *this;
   }
 
   Rational& operator/=(const Rational& number) {
-    nominator_ *= number.denominator_;
-    denominator_ *= number.nominator_;
+    if (this == &number) {
+      *this = 1;
+      return *this;
+    }
+    if (multiplySmall(number, true)) {
+      return *this;
+    }
+    if (is_lazy_) {
+      nominator_ *= number.denominator_;
+      denominator_ *= number.nominator_;
+    } else {
+      normalize();
+      number.normalize();
+      multiplyReduced(number.denominator_, number.nominator_);
+    }
     if (!denominator_.isPositive()) {
       denominator_.changeSgn();
       nominator_.changeSgn();
     }
-    squeeze();
+    if (is_lazy_) {
+      reduce();
+    }
     return *this;
   }
 
   Rational& operator-=(const Rational& number) {
-    BigInteger sec_nom = number.nominator_ * denominator_;
-    denominator_ *= number.denominator_;
+    if (this == &number) {
+      *this = 0;
+      return *this;
+    }
+    if (addSmall(number, true)) {
+      return *this;
+    }
+    if (!is_lazy_) {
+      normalize();
+      number.normalize();
+      addReduced(number, true);
+      return *this;
+    }
     nominator_ *= number.denominator_;
-    nominator_ -= sec_nom;
-    squeeze();
+    nominator_.subMul(number.nominator_, denominator_);
+    denominator_ *= number.denominator_;
+    reduce();
     return *this;
   }
 
   Rational& operator+=(const Rational& number) {
-    BigInteger sec_nom = number.nominator_ * denominator_;
-    denominator_ *= number.denominator_;
+    if (this == &number) {
+      nominator_ += nominator_;
+      reduce();
+      return *this;
+    }
+    if (addSmall(number, false)) {
+      return *this;
+    }
+    if (!is_lazy_) {
+      normalize();
+      number.normalize();
+      addReduced(number, false);
+      return *this;
+    }
     nominator_ *= number.denominator_;
-    nominator_ += sec_nom;
-    squeeze();
+    nominator_.addMul(number.nominator_, denominator_);
+    denominator_ *= number.denominator_;
+    reduce();
     return *this;
   }
 
   std::string toString() const {
+    normalize();
     std::string result;
     result += nominator_.toString();
     if (denominator_ != 1) {
@@ -531,103 +2738,559 @@ class Rational {
     return result;
   }
 
-  Rational operator-() {
+  // Closest fraction with a denominator of at most max_denominator (>= 1).
+  // The continued fraction of |*this| is followed to the last convergent
+  // that fits, which is then compared with the best semiconvergent below
+  // the bound; ties go to the convergent, so -x maps to -x' exactly.
+  Rational limitDenominator(const BigInteger& max_denominator) const {
+    normalize();
+    if (denominator_.compareWithoutSign(max_denominator) <= 0) {
+      return *this;
+    }
+    BigInteger previous_nominator = 0;
+    BigInteger previous_denominator = 1;
+    BigInteger nominator = 1;
+    BigInteger denominator = 0;
+    BigInteger remainder = nominator_;
+    remainder.is_positive_ = true;
+    BigInteger divider = denominator_;
+    while (true) {
+      BigInteger quotient = remainder.divMod(divider);
+      BigInteger next_denominator = previous_denominator;
+      next_denominator.addMul(quotient, denominator);
+      if (next_denominator > max_denominator) {
+        break;
+      }
+      previous_nominator.addMul(quotient, nominator);
+      std::swap(previous_nominator, nominator);
+      previous_denominator = std::move(denominator);
+      denominator = std::move(next_denominator);
+      std::swap(remainder, divider);
+    }
+    BigInteger steps = (max_denominator - previous_denominator) / denominator;
+    previous_nominator.addMul(steps, nominator);
+    previous_denominator.addMul(steps, denominator);
+    Rational convergent = fromReduced(std::move(nominator),
+                                      std::move(denominator));
+    Rational semiconvergent = fromReduced(std::move(previous_nominator),
+                                          std::move(previous_denominator));
+    if (!nominator_.isPositive()) {
+      convergent.nominator_.changeSgn();
+      semiconvergent.nominator_.changeSgn();
+    }
+    Rational convergent_error = convergent;
+    convergent_error -= *this;
+    convergent_error.nominator_.is_positive_ = true;
+    Rational semiconvergent_error = semiconvergent;
+    semiconvergent_error -= *this;
+    semiconvergent_error.nominator_.is_positive_ = true;
+    return convergent_error.compare(semiconvergent_error) <= 0
+               ? convergent
+               : semiconvergent;
+  }
+
+  Rational operator-() const& {
     Rational result = *this;
     result.nominator_.changeSgn();
     return result;
   }
 
-  const BigInteger& getNom() const { return nominator_; }
+  Rational operator-() && {
+    nominator_.changeSgn();
+    return std::move(*this);
+  }
+
+  // Three-way comparison: -1, 0 or 1. Signs, equal denominators and bit
+  // lengths decide most cases before the two cross products are formed.
+  int compare(const Rational& number) const {
+    int sign = nominator_.sign();
+    int number_sign = number.nominator_.sign();
+    if (sign != number_sign) {
+      return sign < number_sign ? -1 : 1;
+    }
+    if (sign == 0) {
+      return 0;
+    }
+    if (denominator_.compareWithoutSign(number.denominator_) == 0) {
+      return sign * nominator_.compareWithoutSign(number.nominator_);
+    }
+    int64_t parts[4];
+    if (toSmall(parts[0], parts[1]) &&
+        number.toSmall(parts[2], parts[3])) {
+      __int128 first = static_cast<__int128>(parts[0]) * parts[3];
+      __int128 second = static_cast<__int128>(parts[2]) * parts[1];
+      return first < second ? -1 : (first > second ? 1 : 0);
+    }
+    // With a = bitLength(nominator) and b = bitLength(denominator) the
+    // magnitude lies strictly between 2^(a - b - 1) and 2^(a - b + 1).
+    ptrdiff_t log = static_cast<ptrdiff_t>(nominator_.bitLength()) -
+                    static_cast<ptrdiff_t>(denominator_.bitLength());
+    ptrdiff_t number_log =
+        static_cast<ptrdiff_t>(number.nominator_.bitLength()) -
+        static_cast<ptrdiff_t>(number.denominator_.bitLength());
+    if (log > number_log + 1) {
+      return sign;
+    }
+    if (log + 1 < number_log) {
+      return -sign;
+    }
+    BigInteger cross = nominator_ * number.denominator_;
+    return sign *
+           cross.compareWithoutSign(number.nominator_ * denominator_);
+  }
+
+  // Fractions in lowest terms are equal only if their parts are.
+  bool isEqual(const Rational& number) const {
+    if (is_reduced_ && number.is_reduced_) {
+      return nominator_ == number.nominator_ &&
+             denominator_ == number.denominator_;
+    }
+    return compare(number) == 0;
+  }
+
+  const BigInteger& getNom() const {
+    normalize();
+    return nominator_;
+  }
+
+  const BigInteger& getDenominator() const {
+    normalize();
+    return denominator_;
+  }
 
-  const BigInteger& getDenominator() const { return denominator_; }
+  enum class Rounding { kTruncate, kHalfEven };
 
-  std::string asDecimal(size_t precision = 0) {
+  // Decimal expansion with precision digits after the point. The numerator
+  // is scaled by 10^precision once, so the digits come from a single
+  // division and one divide-and-conquer toString.
+  std::string asDecimal(size_t precision = 0,
+                        Rounding rounding = Rounding::kTruncate) const {
     std::string result;
-    BigInteger nom = nominator_;
-    if (!nom.isPositive()) {
+    if (!nominator_.isPositive()) {
       result += '-';
     }
-    result += (nom / denominator_).toString();
-    nom %= denominator_;
-    if (!nom.isPositive()) {
-      nom.changeSgn();
+    BigInteger remainder = nominator_;
+    if (!remainder.isPositive()) {
+      remainder.changeSgn();
+    }
+    remainder.scaleByPow10(static_cast<int>(precision));
+    BigInteger quotient = remainder.divMod(denominator_);
+    if (rounding == Rounding::kHalfEven) {
+      remainder <<= 1;
+      int half = remainder.compareWithoutSign(denominator_);
+      if (half > 0 || (half == 0 && quotient.testBit(0))) {
+        quotient += 1;
+      }
+    }
+    std::string digits = quotient.toString();
+    if (digits.size() <= precision) {
+      digits.insert(0, precision + 1 - digits.size(), '0');
     }
+    result.append(digits, 0, digits.size() - precision);
     if (precision != 0) {
       result += '.';
-    }
-    for (size_t counter = 0; counter < precision; ++counter) {
-      nom.shiftExponent(1);
-      result += (nom / denominator_).toString();
-      nom %= denominator_;
+      result.append(digits, digits.size() - precision, precision);
     }
     return result;
   }
 
-  explicit operator double() {
-    double result;
-    result = stod(asDecimal(kDoublePrecision));
-    return result;
+  // Nearest double, ties to even. One division yields a 54 or 55 bit
+  // quotient and its remainder decides the rounding.
+  explicit operator double() const {
+    const ptrdiff_t kMantissaBits = std::numeric_limits<double>::digits;
+    const ptrdiff_t kMinExponent =
+        std::numeric_limits<double>::min_exponent - kMantissaBits;
+    if (denominator_ == 1) {
+      return nominator_.toDouble();
+    }
+    bool is_positive = nominator_.isPositive();
+    ptrdiff_t log = static_cast<ptrdiff_t>(nominator_.bitLength()) -
+                    static_cast<ptrdiff_t>(denominator_.bitLength());
+    if (log > std::numeric_limits<double>::max_exponent) {
+      return is_positive ? std::numeric_limits<double>::infinity()
+                         : -std::numeric_limits<double>::infinity();
+    }
+    if (log < kMinExponent - 2) {
+      return is_positive ? 0.0 : -0.0;
+    }
+    ptrdiff_t shift = kMantissaBits + 1 - log;
+    BigInteger remainder = nominator_;
+    remainder.is_positive_ = true;
+    BigInteger divider = denominator_;
+    if (shift >= 0) {
+      remainder <<= static_cast<size_t>(shift);
+    } else {
+      divider <<= static_cast<size_t>(-shift);
+    }
+    BigInteger quotient = remainder.divMod(divider);
+    double magnitude =
+        quotient.roundedToDouble(-shift, !remainder.isZero());
+    return is_positive ? magnitude : -magnitude;
   }
 
  private:
-  void squeeze() {
+  void reduce() {
+    if (!is_lazy_ ||
+        denominator_.bitLength() > reduced_bits_ + lazy_growth_bits_) {
+      squeeze();
+    } else {
+      is_reduced_ = false;
+    }
+  }
+
+  // Values with both parts in int64_t take word-sized fast paths: Henrici's
+  // algorithms with 64-bit gcds and 128-bit products. The results are put
+  // back into the BigIntegers, which hold up to 128 bits inline, so nothing
+  // is allocated. A part that outgrows int64_t sends the next operation to
+  // the BigInteger path, and once values shrink they return to this one.
+  bool toSmall(int64_t& nominator, int64_t& denominator) const {
+    return is_reduced_ && nominator_.toInt64(nominator) &&
+           denominator_.toInt64(denominator);
+  }
+
+  void setSmall(bool is_positive, unsigned __int128 nominator,
+                unsigned __int128 denominator) {
+    nominator_.setMagnitude(nominator);
+    nominator_.is_positive_ = is_positive || nominator == 0;
+    denominator_.setMagnitude(denominator);
+    denominator_.is_positive_ = true;
+    reduced_bits_ = denominator_.bitLength();
+    is_reduced_ = true;
+  }
+
+  static uint64_t magnitude(int64_t value) {
+    return value < 0 ? -static_cast<uint64_t>(value)
+                     : static_cast<uint64_t>(value);
+  }
+
+  bool addSmall(const Rational& number, bool subtract) {
+    int64_t nominator, denominator, number_nominator, number_denominator;
+    if (!toSmall(nominator, denominator) ||
+        !number.toSmall(number_nominator, number_denominator)) {
+      return false;
+    }
+    auto gcd = static_cast<int64_t>(
+        BigInteger::gcdWord(static_cast<uint64_t>(denominator),
+                            static_cast<uint64_t>(number_denominator)));
+    __int128 first =
+        static_cast<__int128>(nominator) * (number_denominator / gcd);
+    __int128 second =
+        static_cast<__int128>(number_nominator) * (denominator / gcd);
+    __int128 sum = subtract ? first - second : first + second;
+    if (sum == 0) {
+      setSmall(true, 0, 1);
+      return true;
+    }
+    unsigned __int128 sum_magnitude =
+        sum < 0 ? -static_cast<unsigned __int128>(sum)
+                : static_cast<unsigned __int128>(sum);
+    auto common = static_cast<int64_t>(BigInteger::gcdWord(
+        static_cast<uint64_t>(sum_magnitude % static_cast<uint64_t>(gcd)),
+        static_cast<uint64_t>(gcd)));
+    setSmall(sum > 0, sum_magnitude / static_cast<uint64_t>(common),
+             static_cast<unsigned __int128>(denominator / gcd) *
+                 static_cast<uint64_t>(number_denominator / common));
+    return true;
+  }
+
+  bool multiplySmall(const Rational& number, bool divide) {
+    int64_t nominator, denominator, number_nominator, number_denominator;
+    if (!toSmall(nominator, denominator) ||
+        !number.toSmall(number_nominator, number_denominator)) {
+      return false;
+    }
+    if (divide) {
+      if (number_nominator == 0) {
+        return false;
+      }
+      std::swap(number_nominator, number_denominator);
+      if (number_denominator < 0) {
+        number_nominator = -number_nominator;
+        number_denominator = -number_denominator;
+      }
+    }
+    if (nominator == 0 || number_nominator == 0) {
+      setSmall(true, 0, 1);
+      return true;
+    }
+    auto first_gcd = static_cast<int64_t>(BigInteger::gcdWord(
+        magnitude(nominator), static_cast<uint64_t>(number_denominator)));
+    auto second_gcd = static_cast<int64_t>(BigInteger::gcdWord(
+        magnitude(number_nominator), static_cast<uint64_t>(denominator)));
+    setSmall((nominator < 0) == (number_nominator < 0),
+             static_cast<unsigned __int128>(
+                 magnitude(nominator / first_gcd)) *
+                 magnitude(number_nominator / second_gcd),
+             static_cast<unsigned __int128>(denominator / second_gcd) *
+                 static_cast<uint64_t>(number_denominator / first_gcd));
+    return true;
+  }
+
+  // Parts known to be coprime, such as convergents, skip the gcd.
+  static Rational fromReduced(BigInteger nominator, BigInteger denominator) {
+    Rational result;
+    result.nominator_ = std::move(nominator);
+    result.denominator_ = std::move(denominator);
+    result.reduced_bits_ = result.denominator_.bitLength();
+    return result;
+  }
+
+  // (a/b) * (c/d) with both fractions in lowest terms. Cancelling gcd(a, d)
+  // and gcd(c, b) first multiplies smaller numbers and leaves a product that
+  // is already reduced (Henrici).
+  void multiplyReduced(const BigInteger& nominator,
+                       const BigInteger& denominator) {
+    if (nominator_ == 0 || nominator == 0) {
+      nominator_ = 0;
+      denominator_ = 1;
+      return;
+    }
+    BigInteger first_gcd = ::Gcd(nominator_, denominator);
+    BigInteger second_gcd = ::Gcd(nominator, denominator_);
+    if (first_gcd != 1) {
+      nominator_ /= first_gcd;
+    }
+    if (second_gcd != 1) {
+      denominator_ /= second_gcd;
+      nominator_ *= nominator / second_gcd;
+    } else {
+      nominator_ *= nominator;
+    }
+    if (first_gcd != 1) {
+      denominator_ *= denominator / first_gcd;
+    } else {
+      denominator_ *= denominator;
+    }
+  }
+
+  // a/b +- c/d with both fractions in lowest terms. With g = gcd(b, d) the
+  // numerator t = a * (d/g) +- c * (b/g) can only share factors of g with
+  // (b/g) * d, so the final gcd is taken against g alone (Henrici).
+  void addReduced(const Rational& number, bool subtract) {
+    BigInteger gcd = ::Gcd(denominator_, number.denominator_);
+    if (gcd == 1) {
+      nominator_ *= number.denominator_;
+      if (subtract) {
+        nominator_.subMul(number.nominator_, denominator_);
+      } else {
+        nominator_.addMul(number.nominator_, denominator_);
+      }
+      denominator_ *= number.denominator_;
+      return;
+    }
+    denominator_ /= gcd;
+    nominator_ *= number.denominator_ / gcd;
+    if (subtract) {
+      nominator_.subMul(number.nominator_, denominator_);
+    } else {
+      nominator_.addMul(number.nominator_, denominator_);
+    }
+    if (nominator_ == 0) {
+      denominator_ = 1;
+      return;
+    }
+    gcd = ::Gcd(nominator_, gcd);
+    if (gcd != 1) {
+      nominator_ /= gcd;
+      denominator_ *= number.denominator_ / gcd;
+    } else {
+      denominator_ *= number.denominator_;
+    }
+  }
+
+  void squeeze() const {
     BigInteger gcd;
     gcd = ::Gcd(nominator_, denominator_);
-    nominator_ /= gcd;
-    denominator_ /= gcd;
+    if (gcd != 1) {
+      nominator_ /= gcd;
+      denominator_ /= gcd;
+    }
+    reduced_bits_ = denominator_.bitLength();
+    is_reduced_ = true;
+  }
+
+  mutable BigInteger nominator_ = 0;
+  mutable BigInteger denominator_ = 1;
+  mutable size_t reduced_bits_ = 1;
+  mutable bool is_reduced_ = true;
+  static inline thread_local bool is_lazy_ = false;
+  static inline thread_local size_t lazy_growth_bits_ = 0;
+
+  friend class LazyNormalizationScope;
+};
+
+// While alive, Rational arithmetic on this thread leaves results unreduced
+// until they are printed, read through getNom()/getDenominator() or
+// normalize()d, or until the denominator has grown by more than growth_bits
+// since it was last reduced. Long accumulations then pay for one gcd
+// instead of one per step. Other threads keep reducing eagerly.
+class LazyNormalizationScope {
+ public:
+  explicit LazyNormalizationScope(size_t growth_bits = 4096)
+      : was_lazy_(Rational::is_lazy_),
+        previous_growth_bits_(Rational::lazy_growth_bits_) {
+    Rational::is_lazy_ = true;
+    Rational::lazy_growth_bits_ = growth_bits;
+  }
+
+  LazyNormalizationScope(const LazyNormalizationScope&) = delete;
+
+  LazyNormalizationScope& operator=(const LazyNormalizationScope&) = delete;
+
+  ~LazyNormalizationScope() {
+    Rational::is_lazy_ = was_lazy_;
+    Rational::lazy_growth_bits_ = previous_growth_bits_;
   }
 
-  BigInteger nominator_ = 0;
-  BigInteger denominator_ = 1;
-  static const size_t kDoublePrecision = 18;
+ private:
+  bool was_lazy_;
+  size_t previous_growth_bits_;
 };
 
-Rational operator+(const Rational& first, const Rational& second) {
-  Rational result = first;
-  result += second;
-  return result;
+Rational operator+(Rational first, const Rational& second) {
+  first += second;
+  return first;
 }
 
-Rational operator-(const Rational& first, const Rational& second) {
-  Rational result = first;
-  result -= second;
-  return result;
+Rational operator+(const Rational& first, Rational&& second) {
+  second += first;
+  return std::move(second);
 }
 
-Rational operator*(const Rational& first, const Rational& second) {
-  Rational result = first;
-  result *= second;
-  return result;
+Rational operator-(Rational first, const Rational& second) {
+  first -= second;
+  return first;
 }
 
-Rational operator/(const Rational& first, const Rational& second) {
-  Rational result = first;
-  result /= second;
-  return result;
+Rational operator-(const Rational& first, Rational&& second) {
+  second -= first;
+  return -std::move(second);
+}
+
+Rational operator*(Rational first, const Rational& second) {
+  first *= second;
+  return first;
+}
+
+Rational operator*(const Rational& first, Rational&& second) {
+  second *= first;
+  return std::move(second);
+}
+
+Rational operator/(Rational first, const Rational& second) {
+  first /= second;
+  return first;
 }
 
 bool operator<(const Rational& first, const Rational& second) {
-  bool result = first.getNom() * second.getDenominator() <
-                second.getNom() * first.getDenominator();
-  return result;
+  return first.compare(second) < 0;
 }
 
 bool operator>(const Rational& first, const Rational& second) {
-  return second < first;
+  return first.compare(second) > 0;
 }
 
 bool operator<=(const Rational& first, const Rational& second) {
-  return !(second < first);
+  return first.compare(second) <= 0;
 }
 
 bool operator>=(const Rational& first, const Rational& second) {
-  return !(first < second);
+  return first.compare(second) >= 0;
 }
 
 bool operator==(const Rational& first, const Rational& second) {
-  return !((first < second) || (second < first));
+  return first.isEqual(second);
 }
 
 bool operator!=(const Rational& first, const Rational& second) {
-  return ((first < second) || (second < first));
+  return !first.isEqual(second);
+}
+
+// Rational that replaces the result of every arithmetic operation by its
+// limitDenominator(max_denominator). It trades exactness for bounded
+// operand sizes and can serve as the Field of a Matrix in iterative
+// pipelines that accept the approximation.
+template <uint64_t max_denominator>
+class BoundedRational : public Rational {
+  static_assert(max_denominator >= 1);
+
+ public:
+  BoundedRational() = default;
+
+  BoundedRational(BigInteger big_int) : Rational(std::move(big_int)) {}
+
+  template <typename Integer,
+            typename = std::enable_if_t<std::is_integral_v<Integer>>>
+  BoundedRational(Integer integer) : Rational(integer) {}
+
+  template <typename Floating,
+            std::enable_if_t<std::is_floating_point_v<Floating>, int> = 0>
+  explicit BoundedRational(Floating value)
+      : BoundedRational(Rational(value)) {}
+
+  BoundedRational(const Rational& number)
+      : Rational(number.limitDenominator(max_denominator)) {}
+
+  BoundedRational& operator+=(const Rational& number) {
+    Rational::operator+=(number);
+    bound();
+    return *this;
+  }
+
+  BoundedRational& operator-=(const Rational& number) {
+    Rational::operator-=(number);
+    bound();
+    return *this;
+  }
+
+  BoundedRational& operator*=(const Rational& number) {
+    Rational::operator*=(number);
+    bound();
+    return *this;
+  }
+
+  BoundedRational& operator/=(const Rational& number) {
+    Rational::operator/=(number);
+    bound();
+    return *this;
+  }
+
+ private:
+  void bound() {
+    if (getDenominator() > max_denominator) {
+      Rational::operator=(limitDenominator(max_denominator));
+    }
+  }
+};
+
+template <uint64_t max_denominator>
+BoundedRational<max_denominator> operator+(
+    BoundedRational<max_denominator> first,
+    const BoundedRational<max_denominator>& second) {
+  first += second;
+  return first;
+}
+
+template <uint64_t max_denominator>
+BoundedRational<max_denominator> operator-(
+    BoundedRational<max_denominator> first,
+    const BoundedRational<max_denominator>& second) {
+  first -= second;
+  return first;
+}
+
+template <uint64_t max_denominator>
+BoundedRational<max_denominator> operator*(
+    BoundedRational<max_denominator> first,
+    const BoundedRational<max_denominator>& second) {
+  first *= second;
+  return first;
+}
+
+template <uint64_t max_denominator>
+BoundedRational<max_denominator> operator/(
+    BoundedRational<max_denominator> first,
+    const BoundedRational<max_denominator>& second) {
+  first /= second;
+  return first;
 }
@@ -0,0 +1,52 @@
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "biginteger.hpp"
+
+// Checks that printing a BigInteger honours the stream's field width, fill
+// and adjustment, and resets the width like any formatted output.
+//
+//   format_test
+
+int failures = 0;
+
+void Expect(const std::string& actual, const std::string& expected,
+            const std::string& name) {
+  if (actual != expected) {
+    std::cout << "FAILED: " << name << ": got \"" << actual
+              << "\", expected \"" << expected << "\"\n";
+    ++failures;
+  }
+}
+
+int main() {
+  {
+    std::ostringstream out;
+    out << "[" << std::setw(6) << BigInteger(42) << "][" << 7 << "]";
+    Expect(out.str(), "[    42][7]", "setw applies to one number");
+  }
+  {
+    std::ostringstream out;
+    out << std::left << std::setfill('*') << std::setw(5) << BigInteger(-3)
+        << "|";
+    Expect(out.str(), "-3***|", "left adjustment and fill");
+  }
+  {
+    BigInteger large = 1;
+    large <<= 4000;
+    std::ostringstream out;
+    out << std::setw(20) << large << std::setw(3) << 1;
+    Expect(out.str(), large.toString() + "  1", "width below the digit count");
+  }
+  {
+    BigInteger large = 1;
+    large <<= 4000;
+    std::ostringstream out;
+    out << large;
+    Expect(out.str(), large.toString(), "no width");
+  }
+  std::cout << (failures == 0 ? "ok" : "some checks failed") << '\n';
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "biginteger.hpp"
+
+// Checks that numbers built inside a MemoryResourceScope and moved out of it
+// stay valid after the resource is released.
+//
+//   memory_resource_test
+
+// Hands out blocks that release() overwrites but keeps allocated, so a
+// number still pointing into them reads garbage instead of freed memory.
+class ScribblingResource : public std::pmr::memory_resource {
+ public:
+  void release() {
+    for (auto& block : blocks_) {
+      std::memset(block.first.get(), 0xA5, block.second);
+    }
+  }
+
+ private:
+  void* do_allocate(size_t bytes, size_t /*alignment*/) override {
+    blocks_.emplace_back(std::make_unique<char[]>(bytes), bytes);
+    return blocks_.back().first.get();
+  }
+
+  void do_deallocate(void* /*pointer*/, size_t /*bytes*/,
+                     size_t /*alignment*/) override {}
+
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  std::vector<std::pair<std::unique_ptr<char[]>, size_t>> blocks_;
+};
+
+BigInteger PassByValue(BigInteger value) { return value; }
+
+int failures = 0;
+
+void Expect(bool condition, const std::string& name) {
+  if (!condition) {
+    std::cout << "FAILED: " << name << '\n';
+    ++failures;
+  }
+}
+
+int main() {
+  BigInteger base = 1;
+  base <<= 1000;
+  base -= 12345;
+  BigInteger square = base * base;
+  BigInteger cube = square * base;
+  Rational fraction = Rational(square) / Rational(cube + 1);
+
+  ScribblingResource arena;
+  std::vector<BigInteger> scoped;
+  std::vector<BigInteger> out;
+  std::vector<Rational> scoped_fractions;
+  {
+    MemoryResourceScope scope(&arena);
+    BigInteger local = base;
+    scoped.push_back(local * local);
+    scoped.push_back(scoped.back() * local);
+    scoped.push_back(local * local);
+    scoped_fractions.push_back(Rational(local * local) /
+                               Rational(local * local * local + 1));
+    BigInteger kept = local * local * local;
+    {
+      MemoryResourceScope heap(nullptr);
+      out.push_back(std::move(kept));
+    }
+  }
+  out.push_back(std::move(scoped[0]));
+  out.emplace_back(std::move(scoped[1]));
+  BigInteger returned = PassByValue(std::move(scoped[2]));
+  Rational moved_fraction(std::move(scoped_fractions[0]));
+  scoped.clear();
+  scoped_fractions.clear();
+  arena.release();
+
+  Expect(out[0] == cube, "push_back under MemoryResourceScope(nullptr)");
+  Expect(out[1] == square, "push_back after the scope");
+  Expect(out[2] == cube, "emplace_back after the scope");
+  Expect(returned == square, "by-value argument and return");
+  Expect(moved_fraction == fraction, "Rational moved after the scope");
+  std::cout << (failures == 0 ? "ok" : "some checks failed") << '\n';
+  return failures == 0 ? 0 : 1;
+}